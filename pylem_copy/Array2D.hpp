@@ -18,6 +18,14 @@
 #include <limits>
 #include <ctime>         //Used for timestamping output files
 #include <unordered_set> //For printStamp
+#include <memory>
+#include <type_traits>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>       //For mapNative()
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "richdem/common/version.hpp"
 #include "richdem/common/constants.hpp"
 using namespace richdem;
@@ -28,6 +36,307 @@ using namespace richdem;
 #include <boost/iostreams/filter/zlib.hpp>
 #endif
 
+/**
+  @brief Header of the native raster format written by Array2D::saveNative().
+
+  The header, followed by the projection string, is padded with zeros to
+  `header_bytes`, a multiple of 4096. The cells follow in i-order, grouped
+  into tiles of `tile_height` full rows; each tile is a contiguous run of
+  the data, so a mapped raster is addressed exactly as one in memory and
+  the OS pages in only the tiles that are touched.
+*/
+struct NativeRasterHeader {
+  char     magic[8];         ///< "PYLEMRAS"
+  uint32_t version;          ///< Format version, currently 1
+  uint32_t value_bytes;      ///< sizeof() the cell type
+  uint32_t value_kind;       ///< 0 unsigned, 1 signed, 2 floating point
+  int32_t  width;            ///< Width of the raster in cells
+  int32_t  height;           ///< Height of the raster in cells
+  int32_t  tile_height;      ///< Rows per tile
+  uint64_t header_bytes;     ///< Offset of the first cell in the file
+  uint64_t projection_bytes; ///< Length of the projection string
+  uint8_t  no_data[8];       ///< NoData value, in the cell type
+  double   geotransform[6];  ///< Geotransform, zeros if there is none
+};
+
+/**
+  @brief Row-major storage, the default layout of Array2D: i = y*width + x.
+*/
+struct RowMajorLayout {
+  static const bool row_major = true; ///< Rows are contiguous runs of cells
+
+  template<class I>
+  static I xyToI(int32_t x, int32_t y, int32_t width, int32_t){
+    return (I)y*(I)width+(I)x;
+  }
+
+  template<class I>
+  static void iToxy(I i, int32_t &x, int32_t &y, int32_t width, int32_t){
+    x = i%width;
+    y = i/width;
+  }
+};
+
+/**
+  @brief Storage in square tiles 2^LOG2_TILE cells on a side, for kernels
+         which visit cells in elevation rather than row order.
+
+  Tiles are stored in row-major order of tiles, each one contiguous, so most
+  of a cell's neighbours in the rows above and below lie in the same tile,
+  within a few cache lines, rather than a whole row away. Within a full tile
+  the cells are in Z-order (Morton order) if MORTON, or row-major otherwise.
+  Tiles clipped by the right and bottom edges of the raster are row-major
+  and only as large as the cells they hold, so the layout has no padding and
+  a raster's size() is unchanged.
+*/
+template<int LOG2_TILE, bool MORTON = false>
+struct TiledLayout {
+  static_assert(1<=LOG2_TILE && LOG2_TILE<=15, "Tiles must be 2 to 32768 cells wide");
+
+  static const bool    row_major = false;
+  static const int32_t TILE      = 1<<LOG2_TILE;
+
+  template<class I>
+  static I xyToI(int32_t x, int32_t y, int32_t width, int32_t height){
+    const int32_t x0 = x & ~(TILE-1);
+    const int32_t y0 = y & ~(TILE-1);
+    const int32_t w  = std::min(TILE, width-x0);
+    const int32_t h  = std::min(TILE, height-y0);
+    const I tile = (I)y0*(I)width + (I)h*(I)x0;
+    if(MORTON && w==TILE && h==TILE)
+      return tile + (spread(x-x0) | spread(y-y0)<<1);
+    return tile + (I)(y-y0)*w + (x-x0);
+  }
+
+  template<class I>
+  static void iToxy(I i, int32_t &x, int32_t &y, int32_t width, int32_t height){
+    const int32_t y0 = (int32_t)(i/((I)TILE*(I)width))*TILE;
+    const int32_t h  = std::min(TILE, height-y0);
+    I r = i - (I)y0*(I)width;
+    const int32_t x0 = (int32_t)(r/((I)h*TILE))*TILE;
+    const int32_t w  = std::min(TILE, width-x0);
+    r -= (I)h*(I)x0;
+    if(MORTON && w==TILE && h==TILE){
+      x = x0 + compact((uint32_t)r);
+      y = y0 + compact((uint32_t)r>>1);
+    } else {
+      x = x0 + (int32_t)(r%w);
+      y = y0 + (int32_t)(r/w);
+    }
+  }
+
+ private:
+  ///Spreads the bits of a 16-bit value over the even bits of the result
+  static uint32_t spread(uint32_t v){
+    v = (v | v<<8) & 0x00FF00FF;
+    v = (v | v<<4) & 0x0F0F0F0F;
+    v = (v | v<<2) & 0x33333333;
+    v = (v | v<<1) & 0x55555555;
+    return v;
+  }
+
+  ///Inverse of spread(), reading the even bits
+  static int32_t compact(uint32_t v){
+    v &= 0x55555555;
+    v = (v | v>>1) & 0x33333333;
+    v = (v | v>>2) & 0x0F0F0F0F;
+    v = (v | v>>4) & 0x00FF00FF;
+    v = (v | v>>8) & 0x0000FFFF;
+    return v;
+  }
+};
+
+///Square tiles, row-major within each tile
+template<int LOG2_TILE = 5>
+using BlockedLayout = TiledLayout<LOG2_TILE, false>;
+
+///Square tiles, Z-ordered within each tile
+template<int LOG2_TILE = 5>
+using MortonLayout = TiledLayout<LOG2_TILE, true>;
+
+/**
+  @brief A non-owning view of cells evenly spaced in memory, such as a row or
+         column of an Array2D.
+
+  Reads and writes go to the raster's memory. The span is valid while that
+  memory is: until the raster is resized, cleared, or assigned to.
+*/
+template<class T>
+class Array2DSpan {
+ public:
+  ///Random-access iterator over the span's cells
+  class iterator {
+   public:
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef typename std::remove_const<T>::type value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef T* pointer;
+    typedef T& reference;
+
+    iterator(T *cell, std::ptrdiff_t step) : cell(cell), step(step) {}
+
+    T& operator*()  const { return *cell; }
+    T* operator->() const { return cell;  }
+    T& operator[](std::ptrdiff_t n) const { return cell[n*step]; }
+
+    iterator& operator++()    { cell += step; return *this; }
+    iterator& operator--()    { cell -= step; return *this; }
+    iterator  operator++(int) { iterator old = *this; cell += step; return old; }
+    iterator  operator--(int) { iterator old = *this; cell -= step; return old; }
+    iterator& operator+=(std::ptrdiff_t n) { cell += n*step; return *this; }
+    iterator& operator-=(std::ptrdiff_t n) { cell -= n*step; return *this; }
+    iterator  operator+(std::ptrdiff_t n) const { return iterator(cell+n*step, step); }
+    iterator  operator-(std::ptrdiff_t n) const { return iterator(cell-n*step, step); }
+    std::ptrdiff_t operator-(const iterator &o) const { return (cell-o.cell)/step; }
+
+    bool operator==(const iterator &o) const { return cell==o.cell; }
+    bool operator!=(const iterator &o) const { return cell!=o.cell; }
+    bool operator< (const iterator &o) const { return (cell-o.cell)/step<0; }
+    bool operator> (const iterator &o) const { return o<*this;    }
+    bool operator<=(const iterator &o) const { return !(o<*this); }
+    bool operator>=(const iterator &o) const { return !(*this<o); }
+
+   private:
+    T *cell;
+    std::ptrdiff_t step;
+  };
+
+  Array2DSpan() : first(nullptr), count(0), step(1) {}
+
+  /**
+    @param[in] first  The first cell
+    @param[in] count  Number of cells
+    @param[in] step   Distance between successive cells, in cells
+  */
+  Array2DSpan(T *first, size_t count, std::ptrdiff_t step = 1) : first(first), count(count), step(step) {}
+
+  ///A span of const cells may be made from a span of mutable ones
+  template<class U, class = typename std::enable_if<std::is_convertible<U*,T*>::value>::type>
+  Array2DSpan(const Array2DSpan<U> &o) : first(o.data()), count(o.size()), step(o.stride()) {}
+
+  T& operator[](size_t n) const { return first[(std::ptrdiff_t)n*step]; }
+
+  size_t size()  const { return count;    }
+  bool   empty() const { return count==0; }
+
+  ///The first cell
+  T* data() const { return first; }
+
+  ///Distance between successive cells, in cells. 1 if the span is contiguous.
+  std::ptrdiff_t stride() const { return step; }
+
+  iterator begin() const { return iterator(first, step); }
+  iterator end()   const { return iterator(first+(std::ptrdiff_t)count*step, step); }
+
+  ///Copies the cells out, for callers which need a std::vector
+  std::vector<typename std::remove_const<T>::type> toVector() const {
+    return std::vector<typename std::remove_const<T>::type>(begin(), end());
+  }
+
+ private:
+  T *first;
+  size_t count;
+  std::ptrdiff_t step;
+};
+
+/**
+  @brief A non-owning view of a rectangular sub-window of a row-major
+         Array2D.
+
+  Cells are addressed by their xy-coordinates within the window. The window
+  carries its offsets within the raster, as Array2D's viewXoff() and
+  viewYoff() do, so an algorithm working on one tile of a raster can run on
+  a window of it without extracting the tile. Sub-windows of a window add to
+  its offsets.
+
+  Like Array2DSpan, a window is valid while the raster's memory is.
+*/
+template<class T, class I = uint32_t>
+class Array2DWindow {
+ public:
+  typedef int32_t xy_t;   ///< xy-addressing data type
+  typedef I       i_t;    ///< i-addressing data type
+
+  Array2DWindow() {}
+
+  /**
+    @param[in] origin  Cell (0,0) of the window
+    @param[in] width   Width of the window
+    @param[in] height  Height of the window
+    @param[in] stride  Distance between the window's rows, in cells: the
+                       width of the raster it views
+    @param[in] xoff    X-offset of the window in the raster
+    @param[in] yoff    Y-offset of the window in the raster
+  */
+  Array2DWindow(T *origin, xy_t width, xy_t height, i_t stride, xy_t xoff, xy_t yoff)
+    : origin(origin), view_width(width), view_height(height), stride(stride), view_xoff(xoff), view_yoff(yoff) {}
+
+  ///A window of const cells may be made from a window of mutable ones
+  template<class U, class = typename std::enable_if<std::is_convertible<U*,T*>::value>::type>
+  Array2DWindow(const Array2DWindow<U,I> &o)
+    : origin(o.getData()), view_width(o.width()), view_height(o.height()), stride(o.rowStride()), view_xoff(o.viewXoff()), view_yoff(o.viewYoff()) {}
+
+  xy_t width()  const { return view_width;  }
+  xy_t height() const { return view_height; }
+
+  ///X-Offset of this window in the raster it views
+  xy_t viewXoff() const { return view_xoff; }
+
+  ///Y-Offset of this window in the raster it views
+  xy_t viewYoff() const { return view_yoff; }
+
+  ///Distance between the window's rows, in cells
+  i_t rowStride() const { return stride; }
+
+  ///Cell (0,0) of the window
+  T* getData() const { return origin; }
+
+  ///Number of cells in the window
+  i_t size() const { return (i_t)view_width*view_height; }
+
+  ///TRUE if (x,y) lies within the window
+  bool inGrid(xy_t x, xy_t y) const {
+    return 0<=x && x<view_width && 0<=y && y<view_height;
+  }
+
+  ///Cell (x,y) of the window
+  T& operator()(xy_t x, xy_t y) const {
+    assert(inGrid(x,y));
+    return origin[(i_t)y*stride+x];
+  }
+
+  ///Row y of the window, contiguous
+  Array2DSpan<T> row(xy_t y) const {
+    assert(0<=y && y<view_height);
+    return Array2DSpan<T>(origin+(i_t)y*stride, view_width);
+  }
+
+  ///Column x of the window, strided
+  Array2DSpan<T> col(xy_t x) const {
+    assert(0<=x && x<view_width);
+    return Array2DSpan<T>(origin+x, view_height, stride);
+  }
+
+  /**
+    @brief A window of this window. Its offsets are relative to the raster.
+
+    @throws std::runtime_error if the sub-window does not fit in this one
+  */
+  Array2DWindow<T,I> window(xy_t x, xy_t y, xy_t width, xy_t height) const {
+    if(x<0 || y<0 || width<0 || height<0 || x+width>view_width || y+height>view_height)
+      throw std::runtime_error("window(): the sub-window does not fit in the window");
+    return Array2DWindow<T,I>(origin+(i_t)y*stride+x, width, height, stride, view_xoff+x, view_yoff+y);
+  }
+
+ private:
+  T   *origin      = nullptr;
+  xy_t view_width  = 0;
+  xy_t view_height = 0;
+  i_t  stride      = 0;
+  xy_t view_xoff   = 0;
+  xy_t view_yoff   = 0;
+};
+
 /**
   @brief  Class to hold and manipulate GDAL and native rasters
   @author Richard Barnes (rbarnes@umn.edu)
@@ -40,6 +349,14 @@ using namespace richdem;
   transfer projections and geotransforms, but not the actual data. This is
   useful for say, create a flow directions raster which is homologous to a DEM.
 
+  An Array2D normally owns its data, but it can also be a view of a block of
+  memory it does not own, such as a NumPy array, or of a file in the native
+  format mapped by mapNative(). A view reads and writes that memory directly.
+  Copying a view, or resizing it, gives a raster which owns a copy of the data.
+  Rows, columns and rectangular windows of a raster can also be viewed in place,
+  through rowSpan(), colSpan() and window(), so that code which only reads
+  them need not copy them as getRowData() and friends do.
+
   Array2D implements two addressing schemes: "xy" and "i". All methods are
   available in each scheme; users may use whichever is convenient. The xy-scheme
   accesses raster cells by their xy-coordinates. The i-scheme accesses cells by
@@ -50,8 +367,23 @@ using namespace richdem;
   using xy-addressing and then convert them to i-addressing if additional speed
   is desired. The results of the two versions can then be compared against each
   other to verify that using i-addressing has not introduced any errors.
+
+  The i-addressing type is a template parameter. The default, uint32_t,
+  addresses grids of up to ~65535^2 cells and halves the memory of index
+  arrays built over them; uint64_t addresses anything that fits in memory.
+
+  How xy-addresses map to i-addresses is set at compile time by the layout,
+  a further template parameter. The default, RowMajorLayout, stores rows one
+  after another, as NumPy does; every kernel taking an Array2D<T,I,L> expects
+  it. BlockedLayout and MortonLayout store square tiles, which keeps cells
+  close in xy close in memory for algorithms, such as priority_flood_epsilon(),
+  which address cells by xy in an irregular order. Methods which work on
+  whole rows of memory require the row-major layout.
+
+  @tparam I  Unsigned integer type of i-addresses
+  @tparam L  Storage layout: RowMajorLayout, BlockedLayout or MortonLayout
 */
-template<class T>
+template<class T, class I = uint32_t, class L = RowMajorLayout>
 class Array2D {
  public:
   std::string filename;             ///< TODO
@@ -60,18 +392,21 @@ class Array2D {
   std::string projection;           ///< Projection of the raster
   std::string processing_history;   ///< List of commands previously run on this dataset
 
-  //Using uint32_t for i-addressing allows for rasters of ~65535^2. These
-  //dimensions fit easily within an int32_t xy-address.
+  //xy-addresses stay 32-bit whatever I is: a raster too wide for them could
+  //not be held in memory anyway.
   typedef int32_t  xy_t;            ///< xy-addressing data type
-  typedef uint32_t i_t;             ///< i-addressing data type
+  typedef I        i_t;             ///< i-addressing data type
+  typedef L        layout_t;        ///< Storage layout
 
   static const i_t NO_I = std::numeric_limits<i_t>::max();
 
  private:
-  template<typename> friend class Array2D;
+  template<typename, typename, typename> friend class Array2D;
 
-  std::vector<T> data;              ///< Holds the raster data in a 1D array
-                                    ///< this improves caching versus a 2D array
+  std::vector<T> storage;           ///< Holds the raster data if it is owned
+  T   *data = nullptr;              ///< The raster data in a 1D array; this
+                                    ///< improves caching versus a 2D array
+  bool owned = true;                ///< FALSE if data points to external memory
 
   T   no_data;                      ///< NoData value of the raster
   i_t num_data_cells = NO_I;        ///< Number of cells which are not NoData
@@ -88,7 +423,50 @@ class Array2D {
 
   ///If TRUE, loadData() loads data from the cache assuming  the Native format.
   ///Otherwise, it assumes it is loading from a GDAL file.
-  bool from_cache;
+  bool from_cache = false;
+
+  std::shared_ptr<void> mapping;    ///< Unmaps the file data points into, if
+                                    ///< it was mapped by mapNative()
+  xy_t tile_height = 0;             ///< Rows per tile of the mapped file
+
+  ///Kind of the cell type, as NativeRasterHeader::value_kind
+  static uint32_t nativeKind(){
+    if(!std::numeric_limits<T>::is_integer)
+      return 2;
+    return std::numeric_limits<T>::is_signed ? 1 : 0;
+  }
+
+  ///Reads and checks the header and projection of a native raster file
+  static NativeRasterHeader readNativeHeader(std::istream &fin, std::string &projection, const std::string &filename){
+    NativeRasterHeader header;
+    fin.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if(!fin || std::memcmp(header.magic, "PYLEMRAS", 8)!=0)
+      throw std::runtime_error("Not a native raster file: '"+filename+"'");
+    if(header.version!=1)
+      throw std::runtime_error("Unsupported native raster version in '"+filename+"'");
+    if(header.value_bytes!=sizeof(T) || header.value_kind!=nativeKind())
+      throw std::runtime_error("Native raster '"+filename+"' does not hold cells of this raster's type");
+    if(header.width<0 || header.height<0 || (uint64_t)header.width*header.height>std::numeric_limits<I>::max())
+      throw std::runtime_error("Native raster '"+filename+"' is too large for this raster's index type");
+    projection.resize(header.projection_bytes);
+    fin.read(&projection[0], header.projection_bytes);
+    if(!fin)
+      throw std::runtime_error("Truncated native raster file: '"+filename+"'");
+    return header;
+  }
+
+  ///Takes the properties of a native raster file from its header
+  void setNativeProperties(const NativeRasterHeader &header, std::string &&proj){
+    view_width   = header.width;
+    view_height  = header.height;
+    view_xoff    = 0;
+    view_yoff    = 0;
+    tile_height  = header.tile_height;
+    projection   = std::move(proj);
+    geotransform.assign(header.geotransform, header.geotransform+6);
+    std::memcpy(&no_data, header.no_data, sizeof(T));
+    num_data_cells = NO_I;
+  }
 
  public:
   Array2D(){
@@ -110,6 +488,31 @@ class Array2D {
     resize(width,height,val);
   }
 
+  /**
+    @brief Creates a view of a block of row-major memory without copying it
+
+    The memory must outlive the view. The view does not free it.
+
+    @param[in] data0   Pointer to the first cell
+    @param[in] width   Width of the raster
+    @param[in] height  Height of the raster
+  */
+  Array2D(T *data0, xy_t width, xy_t height) : Array2D() {
+    data        = data0;
+    owned       = false;
+    view_width  = width;
+    view_height = height;
+  }
+
+  ///Copies another raster's properties and data. The copy owns its data.
+  Array2D(const Array2D<T,I,L> &other) : Array2D() {
+    *this = other;
+  }
+
+  Array2D(Array2D<T,I,L> &&other) : Array2D() {
+    *this = std::move(other);
+  }
+
   /**
     @brief Create a raster with the same properties and dimensions as another
            raster. No data is copied between the two.
@@ -118,8 +521,8 @@ class Array2D {
     @param[in] val     Initial value of all the raster's cells. Defaults to the
                        Array2D template type's default value
   */
-  template<class U>
-  Array2D(const Array2D<U> &other, const T& val=T()) : Array2D() {
+  template<class U, class J, class M>
+  Array2D(const Array2D<U,J,M> &other, const T& val=T()) : Array2D() {
     view_width         = other.view_width;
     view_height        = other.view_height;
     view_xoff          = other.view_xoff;
@@ -139,19 +542,187 @@ class Array2D {
     @brief Caches the raster data and all its properties to disk. Data is then
            purged from RAM.
 
-    @param[in] filename File to save the data to
+    @pre   The cache file has been named with setCacheFilename()
 
     @post  Calls to loadData() after this will result in data being loaded from
            the cache.
   */
+  void dumpData(){
+    if(filename.empty())
+      throw std::runtime_error("dumpData(): no cache filename has been set");
+    saveNative(filename);
+    clear();
+    from_cache = true;
+  }
+
+  /**
+    @brief Brings back data purged by dumpData() by mapping the cache file.
+           Writes are private to this raster; the cache is left untouched.
+  */
+  void loadData(){
+    if(!from_cache)
+      throw std::runtime_error("loadData(): the raster has not been cached");
+    mapNative(filename);
+  }
+
+  /**
+    @brief Saves the raster and its properties in the native format
+           described by NativeRasterHeader.
+
+    @param[in] filename     File to write
+    @param[in] tile_rows    Rows per tile. If 0 or less, tiles of about 1 MiB
+                            are used.
+  */
+  void saveNative(const std::string &filename, xy_t tile_rows = 0) const {
+    static_assert(L::row_major, "saveNative() requires the row-major layout");
+    static_assert(sizeof(T)<=8, "saveNative() stores NoData in 8 bytes");
+
+    if(tile_rows<=0)
+      tile_rows = std::max<xy_t>(1, (1<<20)/std::max<int64_t>(1, (int64_t)view_width*sizeof(T)));
+
+    NativeRasterHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "PYLEMRAS", 8);
+    header.version          = 1;
+    header.value_bytes      = sizeof(T);
+    header.value_kind       = nativeKind();
+    header.width            = view_width;
+    header.height           = view_height;
+    header.tile_height      = std::min(tile_rows, std::max<xy_t>(1, view_height));
+    header.projection_bytes = projection.size();
+    header.header_bytes     = (sizeof(header)+projection.size()+4095)/4096*4096;
+    std::memcpy(header.no_data, &no_data, sizeof(T));
+    for(size_t g=0;g<geotransform.size() && g<6;g++)
+      header.geotransform[g] = geotransform[g];
+
+    std::ofstream fout(filename, std::ios::binary | std::ios::trunc);
+    if(!fout.good())
+      throw std::runtime_error("Failed to open native raster '"+filename+"' for writing");
+    fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    fout.write(projection.data(), projection.size());
+    const std::vector<char> padding(header.header_bytes-sizeof(header)-projection.size(), 0);
+    fout.write(padding.data(), padding.size());
+    if(data!=nullptr)
+      fout.write(reinterpret_cast<const char*>(data), (std::streamsize)size()*sizeof(T));
+    if(!fout.good())
+      throw std::runtime_error("Failed to write native raster '"+filename+"'");
+  }
+
+  /**
+    @brief Reads a raster saved by saveNative() into memory it owns.
+
+    @param[in] filename File to read
+  */
+  void loadNative(const std::string &filename){
+    static_assert(L::row_major, "loadNative() requires the row-major layout");
+    std::ifstream fin(filename, std::ios::binary);
+    if(!fin.good())
+      throw std::runtime_error("Failed to open native raster '"+filename+"'");
+    std::string proj;
+    const NativeRasterHeader header = readNativeHeader(fin, proj, filename);
+
+    resize(header.width, header.height);
+    setNativeProperties(header, std::move(proj));
+    fin.seekg(header.header_bytes);
+    fin.read(reinterpret_cast<char*>(data), (std::streamsize)size()*sizeof(T));
+    if(!fin)
+      throw std::runtime_error("Truncated native raster file: '"+filename+"'");
+  }
+
+  /**
+    @brief Backs the raster with a mapping of a file saved by saveNative(),
+           without reading it.
+
+    Opening takes the same time whatever the size of the raster: tiles are
+    read from disk as cells in them are first touched, and may be dropped
+    from RAM again under memory pressure. The raster is a view of the
+    mapping, which lasts until the raster is cleared, resized, or assigned
+    to, or is destroyed.
+
+    @param[in] filename File to map
+    @param[in] writable If TRUE, writes to the raster go to the file.
+                        Otherwise they are private to this raster
+                        (copy-on-write) and the file is left untouched.
+  */
+  void mapNative(const std::string &filename, bool writable = false){
+    static_assert(L::row_major, "mapNative() requires the row-major layout");
+    std::string proj;
+    NativeRasterHeader header;
+    {
+      std::ifstream fin(filename, std::ios::binary);
+      if(!fin.good())
+        throw std::runtime_error("Failed to open native raster '"+filename+"'");
+      header = readNativeHeader(fin, proj, filename);
+    }
+
+    const int fd = open(filename.c_str(), writable ? O_RDWR : O_RDONLY);
+    if(fd<0)
+      throw std::runtime_error("Failed to open native raster '"+filename+"' for mapping");
+    struct stat st;
+    const uint64_t bytes = header.header_bytes + (uint64_t)header.width*header.height*sizeof(T);
+    if(fstat(fd, &st)!=0 || (uint64_t)st.st_size<bytes){
+      close(fd);
+      throw std::runtime_error("Truncated native raster file: '"+filename+"'");
+    }
+
+    //The whole file is mapped, so the header need not be aligned to the
+    //page size of the machine reading it
+    void *base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base==MAP_FAILED)
+      throw std::runtime_error("Failed to map native raster '"+filename+"'");
+
+    clear();
+    mapping = std::shared_ptr<void>(base, [bytes](void *p){ munmap(p, bytes); });
+    data    = reinterpret_cast<T*>(static_cast<char*>(base)+header.header_bytes);
+    owned   = false;
+    setNativeProperties(header, std::move(proj));
+  }
+
+  ///TRUE if the raster is backed by a file mapped by mapNative()
+  bool isMapped() const { return (bool)mapping; }
+
+  /**
+    @brief Asks the OS to read the tiles holding rows [y0, y1) of a mapped
+           raster ahead of their use, such as before a pass which will sweep
+           them. Does nothing for a raster in memory.
+  */
+  void prefetchRows(xy_t y0, xy_t y1) const {
+    static_assert(L::row_major, "prefetchRows() requires the row-major layout");
+    if(!mapping || view_width==0)
+      return;
+    y0 = std::max<xy_t>(0, y0);
+    y1 = std::min(view_height, y1);
+    if(y0>=y1)
+      return;
+    y0 = y0/tile_height*tile_height;
+    y1 = std::min(view_height, (y1+tile_height-1)/tile_height*tile_height);
+
+    const uintptr_t page  = sysconf(_SC_PAGESIZE);
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(data+(i_t)y0*view_width)/page*page;
+    const uintptr_t end   = reinterpret_cast<uintptr_t>(data+(i_t)y1*view_width);
+    madvise(reinterpret_cast<void*>(begin), end-begin, MADV_WILLNEED);
+  }
 
   ///Returns a reference to the internal data array
-  T* getData() { return data.data(); }
+  T* getData() { return data; }
+
+  const T* getData() const { return data; }
+
+  ///Returns a copy of the internal data array. dataSpan() reads it without
+  ///copying.
+  std::vector<T> getDataVector() const { return std::vector<T>(data, data+size()); }
+
+  ///@{ A view of every cell, in i-order
+  Array2DSpan<T>       dataSpan()       { return Array2DSpan<T>(data, size());       }
+  Array2DSpan<const T> dataSpan() const { return Array2DSpan<const T>(data, size()); }
+  ///@}
 
-  std::vector<T> getDataVector() {return data; }
+  ///Returns TRUE if the raster is a view of memory it does not own
+  bool isView() const { return !owned; }
 
   ///@brief Number of cells in the DEM
-  i_t size() const { return view_width*view_height; }
+  i_t size() const { return (i_t)view_width*view_height; }
 
   ///Width of the raster
   xy_t width() const { return view_width; }
@@ -166,7 +737,7 @@ class Array2D {
   xy_t viewYoff() const { return view_yoff; }
 
   ///Returns TRUE if no data is present in RAM
-  bool empty() const { return data.empty(); }
+  bool empty() const { return data==nullptr || size()==0; }
 
   ///Returns the NoData value of the raster. Cells equal to this value sould
   ///generally not be used in calculations. But note that the isNoData() method
@@ -176,7 +747,7 @@ class Array2D {
   ///Finds the minimum value of the raster, ignoring NoData cells
   T min() const {
     T minval = std::numeric_limits<T>::max();
-    for(auto const x: data){
+    for(auto const x: *this){
       if(x==no_data)
         continue;
       minval = std::min(minval,x);
@@ -187,7 +758,7 @@ class Array2D {
   ///Finds the maximum value of the raster, ignoring NoData cells
   T max() const {
     T maxval = std::numeric_limits<T>::min();
-    for(auto const x: data){
+    for(auto const x: *this){
       if(x==no_data)
         continue;
       maxval = std::max(maxval,x);
@@ -203,7 +774,7 @@ class Array2D {
     @param[in] newval   Value to replace 'oldval' with
   */
   void replace(const T oldval, const T newval){
-    for(auto &x: data)
+    for(auto &x: *this)
       if(x==oldval)
         x = newval;
   }
@@ -220,7 +791,7 @@ class Array2D {
   i_t countval(const T val) const {
     //TODO: Warn if raster is empty?
     i_t count=0;
-    for(const auto x: data)
+    for(const auto x: *this)
       if(x==val)
         count++;
     return count;
@@ -234,8 +805,7 @@ class Array2D {
     @param[out] y   Y-coordinate of i
   */
   void iToxy(const i_t i, xy_t &x, xy_t &y) const {
-    x = i%view_width;
-    y = i/view_width;
+    L::iToxy(i,x,y,view_width,view_height);
   }
 
   /**
@@ -247,7 +817,7 @@ class Array2D {
     @return Returns the index coordinate i of (x,y)
   */
   i_t xyToI(xy_t x, xy_t y) const {
-    return (i_t)y*(i_t)view_width+(i_t)x;
+    return L::template xyToI<i_t>(x,y,view_width,view_height);
   }
 
   /**
@@ -261,8 +831,10 @@ class Array2D {
     @return i-coordinate of the neighbour. Usually referred to as 'ni'
   */
   i_t nToI(i_t i, xy_t dx, xy_t dy) const {
-    int32_t x=i%view_width+dx;
-    int32_t y=i/view_width+dy;
+    xy_t x, y;
+    iToxy(i,x,y);
+    x += dx;
+    y += dy;
     if(x<0 || y<0 || x>=view_width || y>=view_height)
       return NO_I;
     return xyToI(x,y);
@@ -279,8 +851,10 @@ class Array2D {
   */
   i_t getN(i_t i, uint8_t n) const {
     assert(0<=n && n<=8);
-    xy_t x = i%view_width+(xy_t)dx[n];
-    xy_t y = i/view_width+(xy_t)dy[n];
+    xy_t x, y;
+    iToxy(i,x,y);
+    x += (xy_t)dx[n];
+    y += (xy_t)dy[n];
     if(x<0 || y<0 || x>=view_width || y>=view_height)
       return NO_I;
     return xyToI(x,y);
@@ -294,9 +868,22 @@ class Array2D {
     @return Returns this raster, with the other raster's data and properties
             copied in.
   */
-  template<class U>
-  T& operator=(const Array2D<U> &o){
-    data               = std::vector<T>(o.data.begin(),o.data.end());
+  template<class U, class J, class M>
+  Array2D<T,I,L>& operator=(const Array2D<U,J,M> &o){
+    if(o.data==nullptr)
+      storage.clear();
+    else if(std::is_same<L,M>::value)
+      storage.assign(o.data,o.data+o.size());
+    else {
+      storage.resize(o.size());
+      for(xy_t y=0;y<o.view_height;y++)
+      for(xy_t x=0;x<o.view_width;x++)
+        storage[L::template xyToI<i_t>(x,y,o.view_width,o.view_height)] = (T)o(x,y);
+    }
+    data               = storage.empty() ? nullptr : storage.data();
+    owned              = true;
+    mapping.reset();
+    tile_height        = 0;
     view_height        = o.view_height;
     view_width         = o.view_width;
     view_xoff          = o.view_xoff;
@@ -309,16 +896,51 @@ class Array2D {
     return *this;
   }
 
+  Array2D<T,I,L>& operator=(const Array2D<T,I,L> &o){
+    if(this!=&o)
+      operator=<T,I,L>(o);
+    return *this;
+  }
+
+  ///Takes over another raster's data, or shares its view
+  Array2D<T,I,L>& operator=(Array2D<T,I,L> &&o){
+    if(this==&o)
+      return *this;
+    storage            = std::move(o.storage);
+    data               = o.data;
+    owned              = o.owned;
+    mapping            = std::move(o.mapping);
+    tile_height        = o.tile_height;
+    view_height        = o.view_height;
+    view_width         = o.view_width;
+    view_xoff          = o.view_xoff;
+    view_yoff          = o.view_yoff;
+    num_data_cells     = o.num_data_cells;
+    geotransform       = std::move(o.geotransform);
+    projection         = std::move(o.projection);
+    processing_history = std::move(o.processing_history);
+    no_data            = o.no_data;
+    o.clear();
+    return *this;
+  }
+
+  ///@{ Iterate over the cells in i-order
+  T*       begin()       { return data;        }
+  T*       end()         { return data+size(); }
+  const T* begin() const { return data;        }
+  const T* end()   const { return data+size(); }
+  ///@}
+
   /**
     @brief Determine if two rasters are equivalent based on dimensions,
            NoData value, and their data
   */
-  bool operator==(const Array2D<T> &o){
+  bool operator==(const Array2D<T,I,L> &o){
     if(width()!=o.width() || height()!=o.height())
       return false;
     if(noData()!=o.noData())
       return false;
-    return data==o.data;
+    return std::equal(begin(),end(),o.begin());
   }
 
   /**
@@ -351,11 +973,12 @@ class Array2D {
     @brief Flips the raster from top to bottom
   */
   void flipVert(){
+    static_assert(L::row_major, "flipVert() requires the row-major layout");
     for(xy_t y=0;y<view_height/2;y++)
       std::swap_ranges(
-        data.begin()+xyToI(0,y),
-        data.begin()+xyToI(view_width,y),
-        data.begin()+xyToI(0,view_height-1-y)
+        data+xyToI(0,y),
+        data+xyToI(view_width,y),
+        data+xyToI(0,view_height-1-y)
       );
   }
 
@@ -363,20 +986,22 @@ class Array2D {
     @brief Flips the raster from side-to-side
   */
   void flipHorz(){
+    static_assert(L::row_major, "flipHorz() requires the row-major layout");
     for(xy_t y=0;y<view_height;y++)
-      std::reverse(data.begin()+xyToI(0,y),data.begin()+xyToI(view_width,y));
+      std::reverse(data+xyToI(0,y),data+xyToI(view_width,y));
   }
 
   /**
     @brief Flips the raster about its diagonal axis, like a matrix tranpose.
   */
   void transpose(){
+    static_assert(L::row_major, "transpose() requires the row-major layout");
     std::cerr<<"transpose() is an experimental feature."<<std::endl;
-    std::vector<T> new_data(view_width*view_height);
+    std::vector<T> new_data(size());
     for(xy_t y=0;y<view_height;y++)
     for(xy_t x=0;x<view_width;x++)
       new_data[(i_t)x*(i_t)view_height+(i_t)y] = data[xyToI(x,y)];
-    data = new_data;
+    std::copy(new_data.begin(),new_data.end(),data);
     std::swap(view_width,view_height);
     //TODO: Offsets?
   }
@@ -456,11 +1081,12 @@ class Array2D {
     @param[in]   val      Value to change the cells to
   */
   void setAll(const T val){
-    std::fill(data.begin(),data.end(),val);
+    std::fill(begin(),end(),val);
   }
 
   /**
-    @brief Resize the raster. Note: this clears all the raster's data.
+    @brief Resize the raster. Note: this clears all the raster's data. A view
+           stops viewing its memory and owns the resized data instead.
 
     @param[in]   width    New width of the raster
     @param[in]   height   New height of the raster
@@ -468,10 +1094,14 @@ class Array2D {
                           raster's template type default value
   */
   void resize(xy_t width, xy_t height, const T& val = T()){
-    data.resize(width*height);
-    setAll(val);
+    storage.resize((i_t)width*height);
+    data        = storage.empty() ? nullptr : storage.data();
+    owned       = true;
+    mapping.reset();
+    tile_height = 0;
     view_height = height;
     view_width  = width;
+    setAll(val);
   }
 
   /*
@@ -481,8 +1111,8 @@ class Array2D {
     @param[in]   val      Value to set all the cells to. Defaults to the
                           raster's template type default value
   */
-  template<class U>
-  void resize(const Array2D<U> &other, const T& val = T()){
+  template<class U, class J, class M>
+  void resize(const Array2D<U,J,M> &other, const T& val = T()){
     resize(other.width(), other.height(), val);
     geotransform       = other.geotransform;
     projection         = other.projection;
@@ -501,6 +1131,7 @@ class Array2D {
     @param[in] val        Value to set the new cells to
   */
   void expand(xy_t new_width, xy_t new_height, const T val){
+    static_assert(L::row_major, "expand() requires the row-major layout");
     if(new_width<view_width)
       throw std::runtime_error("expand(): new_width<view_width");
     if(new_height<view_height)
@@ -509,13 +1140,13 @@ class Array2D {
     xy_t old_width  = width();
     xy_t old_height = height();
 
-    std::vector<T> old_data = std::move(data);
+    std::vector<T> old_data(begin(),end());
 
     resize(new_width,new_height,val);
 
     for(xy_t y=0;y<old_height;y++)
     for(xy_t x=0;x<old_width;x++)
-      data[y*new_width+x] = old_data[y*old_width+x];
+      data[(i_t)y*new_width+x] = old_data[(i_t)y*old_width+x];
   }
 
   /**
@@ -523,7 +1154,7 @@ class Array2D {
   */
   void countDataCells(){
     num_data_cells = 0;
-    for(const auto x: data)
+    for(const auto x: *this)
       if(x!=no_data)
         num_data_cells++;
   }
@@ -657,7 +1288,8 @@ class Array2D {
     @param[in] val    The value to set the row to
   */
   void setRow(xy_t y, const T &val){
-    std::fill(data.begin()+xyToI(y,0),data.begin()+xyToI(y,view_width),val);
+    static_assert(L::row_major, "setRow() requires the row-major layout");
+    std::fill(data+xyToI(y,0),data+xyToI(y,view_width),val);
   }
 
   /**
@@ -672,18 +1304,21 @@ class Array2D {
   }
 
   /**
-    @brief Returns a copy of an arbitrary row of the raster
+    @brief Returns a copy of an arbitrary row of the raster. rowSpan() views
+           it without copying.
 
     @param[in]   y    The row to retrieve
 
     @return A vector containing a copy of the selected row
   */
   std::vector<T> getRowData(xy_t y) const {
-    return std::vector<T>(data.begin()+xyToI(0,y),data.begin()+xyToI(view_width,y));
+    static_assert(L::row_major, "getRowData() requires the row-major layout");
+    return std::vector<T>(data+xyToI(0,y),data+xyToI(view_width,y));
   }
 
   /**
-    @brief Returns a copy of an arbitrary column of the raster
+    @brief Returns a copy of an arbitrary column of the raster. colSpan()
+           views it without copying.
 
     @param[in]   x    The column to retrieve
 
@@ -696,10 +1331,62 @@ class Array2D {
     return temp;
   }
 
-  ///Clears all raster data from RAM
+  ///@{ A view of row y, without copying it
+  Array2DSpan<T> rowSpan(xy_t y){
+    static_assert(L::row_major, "rowSpan() requires the row-major layout");
+    assert(0<=y && y<view_height);
+    return Array2DSpan<T>(data+xyToI(0,y), view_width);
+  }
+
+  Array2DSpan<const T> rowSpan(xy_t y) const {
+    static_assert(L::row_major, "rowSpan() requires the row-major layout");
+    assert(0<=y && y<view_height);
+    return Array2DSpan<const T>(data+xyToI(0,y), view_width);
+  }
+  ///@}
+
+  ///@{ A view of column x, without copying it
+  Array2DSpan<T> colSpan(xy_t x){
+    static_assert(L::row_major, "colSpan() requires the row-major layout");
+    assert(0<=x && x<view_width);
+    return Array2DSpan<T>(data+x, view_height, view_width);
+  }
+
+  Array2DSpan<const T> colSpan(xy_t x) const {
+    static_assert(L::row_major, "colSpan() requires the row-major layout");
+    assert(0<=x && x<view_width);
+    return Array2DSpan<const T>(data+x, view_height, view_width);
+  }
+  ///@}
+
+  /**
+    @brief A view of the rectangle of cells with its top-left corner at
+           (x,y), without copying it.
+
+    The window's offsets are those of the rectangle in the raster this one
+    was loaded from: viewXoff()+x and viewYoff()+y.
+
+    @throws std::runtime_error if the rectangle does not fit in the raster
+  */
+  Array2DWindow<T,I> window(xy_t x, xy_t y, xy_t width, xy_t height){
+    static_assert(L::row_major, "window() requires the row-major layout");
+    return Array2DWindow<T,I>(data, view_width, view_height, view_width, view_xoff, view_yoff).window(x, y, width, height);
+  }
+
+  Array2DWindow<const T,I> window(xy_t x, xy_t y, xy_t width, xy_t height) const {
+    static_assert(L::row_major, "window() requires the row-major layout");
+    return Array2DWindow<const T,I>(data, view_width, view_height, view_width, view_xoff, view_yoff).window(x, y, width, height);
+  }
+
+  ///Clears all raster data from RAM. A view just stops viewing its memory,
+  ///and a mapped file is unmapped.
   void clear(){
-    data.clear();
-    data.shrink_to_fit();
+    storage.clear();
+    storage.shrink_to_fit();
+    data  = nullptr;
+    owned = true;
+    mapping.reset();
+    tile_height = 0;
   }
 
   /**
@@ -707,8 +1394,8 @@ class Array2D {
 
     @param[in]    other    Raster to copy from
   */
-  template<class U>
-  void templateCopy(const Array2D<U> &other){
+  template<class U, class J, class M>
+  void templateCopy(const Array2D<U,J,M> &other){
     geotransform       = other.geotransform;
     projection         = other.projection;
     basename           = other.basename;
@@ -1,112 +1,182 @@
 #ifndef _area_slope_hpp_
 #define _area_slope_hpp_
 #include "Array2D.hpp"
+#include "halo_grid.hpp"
 #include "richdem/common/grid_cell.hpp"
+#include "flow_graph.hpp"
 
 #include <iostream>
 #include <vector>
-#include <numeric>      // std::iota
-#include <algorithm>    // std::sort, std::stable_sort
+#include <algorithm>
 #include <cmath>
 
 using namespace std;
 
+//xy-addressing type of code which is not templated on it. The kernels below
+//take i_t from the grids they are given, so 64-bit grids route as 32-bit ones
+//do.
 typedef int32_t  xy_t;
 
-template <class elev_t>
-void update(xy_t this_x, xy_t this_y, xy_t next_x, xy_t next_y, elev_t dx, Array2D<elev_t> &elevations, double &maxSlope, xy_t &max_next_x, xy_t &max_next_y) {
-  elev_t thisSlope = (elevations(this_x, this_y) - elevations(next_x, next_y)) / (((next_x != this_x) || (next_y != this_y)) ? (1.41*dx): dx);
-  if(thisSlope > maxSlope) {
-    maxSlope = thisSlope;
-    max_next_x = next_x;
-    max_next_y = next_y;
-  }
+/**
+  @brief Scratch memory for the flow routing functions. Passing the same
+         scratch to repeated calls on grids of one size lets them run without
+         allocating.
+*/
+template <class elev_t, class i_t = uint32_t>
+struct FlowScratch {
+  vector<i_t> receivers;       ///< D8 or first D-infinity receivers
+  vector<i_t> receivers2;      ///< Second D-infinity receivers
+  vector<elev_t> partitions1;
+  vector<elev_t> partitions2;
+  vector<i_t> donor_offsets;
+  vector<i_t> donors;
+  vector<i_t> stack;           ///< Stack, or D-infinity or MFD order
+  vector<uint8_t> ndonors;
+  vector<i_t> facets1;         ///< Cells of each cell's steepest D-infinity
+  vector<i_t> facets2;         ///< facet, if asked for
+  Array2D<elev_t,i_t> slope;   ///< Slopes found and discarded by length_()
+  HaloArray2D<elev_t,i_t> halo;  ///< Halo-padded copy of the elevations
+};
+
+//The neighbours in the order d8_receivers() probes them, as steps in x and y.
+//Facet k of dinf_receivers() lies between neighbours k and k+1.
+static const int neighbour_x[8] = {-1, 0, 1, 1,  1,  0, -1, -1};
+static const int neighbour_y[8] = { 1, 1, 1, 0, -1, -1, -1,  0};
+
+/**
+  @brief i-coordinate of neighbour k of (x, y), wrapping periodically in x.
+*/
+template <class i_t>
+inline i_t neighbour_i(xy_t x, xy_t y, int k, xy_t nx) {
+  xy_t next_x = x + neighbour_x[k];
+  if(next_x == -1)
+    next_x = nx-1;
+  else if(next_x == nx)
+    next_x = 0;
+  return (i_t)(y + neighbour_y[k])*nx + next_x;
 }
 
+/**
+  @brief Computes the D8 receiver and slope of every cell: the neighbour with
+         the steepest descent, wrapping periodically in x. The top and bottom
+         rows are base level and drain to themselves, as do cells with no
+         lower neighbour.
+
+  The neighbours are read from a halo-padded copy of `elevations`, at fixed
+  offsets.
+
+  @param[out] receivers   Receiver of every cell
+  @param[out] slope       Slope towards the receiver, or 0 if no neighbour is
+                          lower. Untouched on the top and bottom rows.
+  @param[in]  halo        If not NULL, memory reused from earlier calls for
+                          the copy
+*/
+template <class elev_t, class i_t>
+void d8_receivers(Array2D<elev_t,i_t> &elevations, elev_t dx, vector<i_t> &receivers, Array2D<elev_t,i_t> &slope, HaloArray2D<elev_t,i_t> *halo = NULL) {
+
+  HaloArray2D<elev_t,i_t> local;
+  if(halo == NULL)
+    halo = &local;
+  halo->load(elevations);
+
+  const xy_t nx = elevations.width();
+  const xy_t ny = elevations.height();
+
+  receivers.resize(elevations.size());
+
+  for(xy_t this_x=0; this_x<nx; this_x++) {
+    receivers[elevations.xyToI(this_x, 0)]    = elevations.xyToI(this_x, 0);
+    receivers[elevations.xyToI(this_x, ny-1)] = elevations.xyToI(this_x, ny-1);
+  }
 
-template <class elev_t>
-void area_slope(Array2D<elev_t> &elevations, elev_t dx, Array2D<elev_t> &area, Array2D<elev_t> &slope) {
-
-  vector<elev_t> v = elevations.getDataVector();
-  vector<size_t> indices(v.size());
-  iota(indices.begin(), indices.end(), 0);
-  sort(indices.begin(), indices.end(),
-              [&v](int left, int right) -> bool {
-                  // sort indices according to corresponding array element
-                  return v[left] < v[right];
-              });
-  reverse(indices.begin(), indices.end());
-
-  xy_t nx, ny;
-
-  nx = elevations.width();
-  ny = elevations.height();
-
-  for (auto i: indices) {
-
-    xy_t this_x, this_y, next_x, next_y, max_next_x, max_next_y;
-
-    elevations.iToxy(i, this_x, this_y);
-
-    elev_t maxSlope = 0;
-
-    if( (this_y != 0) && (this_y != (ny-1))) {
-
-      next_x = (this_x-1 == -1) ? nx - 1 : this_x - 1;
-      next_y = this_y + 1;
-      update(this_x, this_y, next_x, next_y, dx, elevations, maxSlope, max_next_x, max_next_y);
-
-      next_x = this_x;
-      next_y = this_y + 1;
-      update(this_x, this_y, next_x, next_y, dx, elevations, maxSlope, max_next_x, max_next_y);
-
-      next_x = (this_x+1 == nx) ? 0 : this_x + 1;
-      next_y = this_y + 1;
-      update(this_x, this_y, next_x, next_y, dx, elevations, maxSlope, max_next_x, max_next_y);
-
-      next_x = (this_x+1 == nx) ? 0 : this_x + 1;
-      next_y = this_y;
-      update(this_x, this_y, next_x, next_y, dx, elevations, maxSlope, max_next_x, max_next_y);
-
-      next_x = (this_x+1 == nx) ? 0 : this_x + 1;
-      next_y = this_y - 1;
-      update(this_x, this_y, next_x, next_y, dx, elevations, maxSlope, max_next_x, max_next_y);
-
-      next_x = this_x;
-      next_y = this_y - 1;
-      update(this_x, this_y, next_x, next_y, dx, elevations, maxSlope, max_next_x, max_next_y);
-
-      next_x = (this_x - 1 == -1) ? nx-1 : this_x - 1;
-      next_y = this_y - 1;
-      update(this_x, this_y, next_x, next_y, dx, elevations, maxSlope, max_next_x, max_next_y);
+  typename HaloArray2D<elev_t,i_t>::offset_t offsets[8];
+  for(int k=0; k<8; k++)
+    offsets[k] = halo->offset(neighbour_x[k], neighbour_y[k]);
+
+  //Every neighbour's slope is taken over 1.41 dx: the original test for a
+  //diagonal step held for every neighbour, and receivers and slopes are kept
+  //as they were
+  const double distance = 1.41*dx;
+
+  for(xy_t this_y=1; this_y<ny-1; this_y++) {
+    const elev_t *z = halo->row(this_y);
+    elev_t *s = slope.getData() + (i_t)this_y*nx;
+    for(xy_t this_x=0; this_x<nx; this_x++) {
+      elev_t maxSlope = 0;
+      int steepest = -1;
+      for(int k=0; k<8; k++) {
+        const elev_t thisSlope = (z[this_x] - z[this_x+offsets[k]]) / distance;
+        if(thisSlope > maxSlope) {
+          maxSlope = thisSlope;
+          steepest = k;
+        }
+      }
+      s[this_x] = maxSlope;
+      receivers[(i_t)this_y*nx+this_x] = (steepest < 0) ? (i_t)this_y*nx+this_x : neighbour_i<i_t>(this_x, this_y, steepest, nx);
+    }
+  }
 
-      next_x = (this_x - 1 == -1) ? nx-1 : this_x - 1;
-      next_y = this_y;
-      update(this_x, this_y, next_x, next_y, dx, elevations, maxSlope, max_next_x, max_next_y);
+}
 
-      area(max_next_x, max_next_y) += area(this_x, this_y);
-      slope(this_x, this_y) = maxSlope;
+/**
+  @brief D8 drainage area and slope.
+
+  @param[in] threads  Threads used for the accumulation. The result does not
+                      depend on it. 0 or fewer uses all cores.
+  @param[in] order    If not NULL, the order recorded by
+                      priority_flood_epsilon() when filling `elevations`. It
+                      replaces building the flow graph's stack.
+  @param[in] scratch  If not NULL, memory reused from earlier calls
+*/
+template <class elev_t, class i_t>
+void area_slope(Array2D<elev_t,i_t> &elevations, elev_t dx, Array2D<elev_t,i_t> &area, Array2D<elev_t,i_t> &slope, int threads = 1, const vector<i_t> *order = NULL, FlowScratch<elev_t,i_t> *scratch = NULL) {
+
+  FlowScratch<elev_t,i_t> local;
+  if(scratch == NULL)
+    scratch = &local;
+  vector<i_t> &receivers     = scratch->receivers;
+  vector<i_t> &donor_offsets = scratch->donor_offsets;
+  vector<i_t> &donors        = scratch->donors;
+  vector<i_t> &stack         = scratch->stack;
+
+  d8_receivers(elevations, dx, receivers, slope, &scratch->halo);
+
+  if(order != NULL && threads == 1) {
+    accumulate_receivers(*order, receivers, area.getData());
+    return;
+  }
 
-    }
+  build_donors(receivers, donor_offsets, donors);
 
+  if(threads == 1) {
+    build_stack(receivers, donor_offsets, donors, stack);
+    accumulate(stack, donor_offsets, donors, area.getData());
+  } else {
+    accumulate_parallel(receivers, donor_offsets, donors, area.getData(), threads);
   }
 
 }
 
+/**
+  @brief Slope and partitions of facet k of a cell, if it is the steepest yet.
+
+  @param[in] e0  Elevation of the cell
+  @param[in] e1  Elevation of neighbour k
+  @param[in] e2  Elevation of neighbour k+1
+*/
 template <class elev_t>
-void update_dinf(xy_t this_x, xy_t this_y, xy_t next_x1, xy_t next_y1, xy_t next_x2, xy_t next_y2, elev_t dx,
-  Array2D<elev_t> &elevations, double &maxSlope, xy_t &max_next_x1, xy_t &max_next_y1, xy_t &max_next_x2,
-  xy_t &max_next_y2, elev_t &partition1, elev_t &partition2) {
+void update_dinf(int k, elev_t e0, elev_t e1, elev_t e2, elev_t dx, elev_t &maxSlope, int &max_facet,
+  elev_t &partition1, elev_t &partition2) {
 
-  bool x1IsDiagonal = (next_x1 != this_x) && (next_y1 != this_y);
+  const bool x1IsDiagonal = neighbour_x[k] != 0 && neighbour_y[k] != 0;
   elev_t s1, s2, r, thisSlope;
 
   if(!x1IsDiagonal) {
-    s1 = (elevations(this_x, this_y) - elevations(next_x1, next_y1)) / dx;
-    s2 = (elevations(next_x1, next_y1) - elevations(next_x2, next_y2)) / dx;
+    s1 = (e0 - e1) / dx;
+    s2 = (e1 - e2) / dx;
   } else {
-    s1 = (elevations(this_x, this_y) - elevations(next_x2, next_y2)) / dx;
-    s2 = (elevations(next_x2, next_y2) - elevations(next_x1, next_y1)) / dx;
+    s1 = (e0 - e2) / dx;
+    s2 = (e2 - e1) / dx;
   }
 
   r = atan2(s2, s1);
@@ -116,9 +186,9 @@ void update_dinf(xy_t this_x, xy_t this_y, xy_t next_x1, xy_t next_y1, xy_t next
   } else if(r > atan2(1,1)) {
     r = atan2(1,1);
     if(x1IsDiagonal) {
-      thisSlope =(elevations(this_x, this_y) - elevations(next_x1, next_y1)) / (sqrt(2)*dx);
+      thisSlope =(e0 - e1) / (sqrt(2)*dx);
     } else {
-      thisSlope =(elevations(this_x, this_y) - elevations(next_x2, next_y2)) / (sqrt(2)*dx);
+      thisSlope =(e0 - e2) / (sqrt(2)*dx);
     }
   } else {
     thisSlope = sqrt(pow(s1,2) + pow(s2,2));
@@ -133,185 +203,290 @@ void update_dinf(xy_t this_x, xy_t this_y, xy_t next_x1, xy_t next_y1, xy_t next
       partition2 = 1 - tan(r);
       partition1 = tan(r);
     }
-    max_next_x1 = next_x1;
-    max_next_y1 = next_y1;
-    max_next_x2 = next_x2;
-    max_next_y2 = next_y2;
+    max_facet = k;
   }
 }
 
-template <class elev_t>
-void area_slope_dinf(Array2D<elev_t> &elevations, elev_t dx, Array2D<elev_t> &area, Array2D<elev_t> &slope) {
-
-  vector<elev_t> v = elevations.getDataVector();
-  vector<size_t> indices(v.size());
-  iota(indices.begin(), indices.end(), 0);
-  sort(indices.begin(), indices.end(),
-              [&v](int left, int right) -> bool {
-                  // sort indices according to corresponding array element
-                  return v[left] < v[right];
-              });
-  reverse(indices.begin(), indices.end());
-
-  xy_t nx, ny;
-
-  nx = elevations.width();
-  ny = elevations.height();
-
-  for (auto i: indices) {
-
-    xy_t this_x, this_y, next_x1, next_y1, next_x2, next_y2, max_next_x1, max_next_y1, max_next_x2, max_next_y2;
-
-    elevations.iToxy(i, this_x, this_y);
-
-    elev_t maxSlope = -1.0;
-    elev_t partition1 = 0;
-    elev_t partition2 = 0;
-
-    if( (this_y != 0) && (this_y != (ny-1))) {
-
-      // Facet 6:
-
-      next_x1 = (this_x-1 == -1) ? nx - 1 : this_x - 1;
-      next_y1 = this_y + 1;
-      next_x2 = this_x;
-      next_y2 = this_y + 1;
-      update_dinf(this_x, this_y, next_x1, next_y1, next_x2, next_y2, dx, elevations, maxSlope, max_next_x1, max_next_y1, max_next_x2, max_next_y2, partition1, partition2);
-
-      // Facet 7:
-
-      next_x1 = next_x2;
-      next_y1 = next_y2;
-      next_x2 = (this_x+1 == nx) ? 0 : this_x + 1;
-      next_y2 = this_y + 1;
-      update_dinf(this_x, this_y, next_x1, next_y1, next_x2, next_y2, dx, elevations, maxSlope, max_next_x1, max_next_y1, max_next_x2, max_next_y2, partition1, partition2);
-
-      // Facet 8:
-
-      next_x1 = next_x2;
-      next_y1 = next_y2;
-      next_x2 = (this_x+1 == nx) ? 0 : this_x + 1;
-      next_y2 = this_y;
-      update_dinf(this_x, this_y, next_x1, next_y1, next_x2, next_y2, dx, elevations, maxSlope, max_next_x1, max_next_y1, max_next_x2, max_next_y2, partition1, partition2);
-
-      // Facet 1:
-
-      next_x1 = next_x2;
-      next_y1 = next_y2;
-      next_x2 = (this_x+1 == nx) ? 0 : this_x + 1;
-      next_y2 = this_y - 1;
-      update_dinf(this_x, this_y, next_x1, next_y1, next_x2, next_y2, dx, elevations, maxSlope, max_next_x1, max_next_y1, max_next_x2, max_next_y2, partition1, partition2);
-
-      // Facet 2:
-
-      next_x1 = next_x2;
-      next_y1 = next_y2;
-      next_x2 = this_x;
-      next_y2 = this_y - 1;
-      update_dinf(this_x, this_y, next_x1, next_y1, next_x2, next_y2, dx, elevations, maxSlope, max_next_x1, max_next_y1, max_next_x2, max_next_y2, partition1, partition2);
-
-      // Facet 3:
-
-      next_x1 = next_x2;
-      next_y1 = next_y2;
-      next_x2 = (this_x-1 == -1) ? nx - 1 : this_x - 1;
-      next_y2 = this_y - 1;
-      update_dinf(this_x, this_y, next_x1, next_y1, next_x2, next_y2, dx, elevations, maxSlope, max_next_x1, max_next_y1, max_next_x2, max_next_y2, partition1, partition2);
-
-      // Facet 4:
+/**
+  @brief Computes the D-infinity receivers, partitions and slope of every cell.
+         Cells with no descending facet, and the top and bottom rows, drain to
+         themselves.
+
+  A receiver which is not strictly lower than its donor is replaced by the
+  donor itself. Its partition is then at most the rounding error of
+  1-tan(pi/4), and dropping it keeps the flow graph acyclic.
+
+  @param[out] receivers1   First receiver of every cell
+  @param[out] receivers2   Second receiver of every cell
+  @param[out] partitions1  Fraction of the cell's area sent to receivers1
+  @param[out] partitions2  Fraction of the cell's area sent to receivers2
+  @param[out] slope        Slope of the steepest facet, where it is positive
+  @param[out] facets1      If not NULL, the first cell of the steepest facet,
+                           whether or not it is lower; the cell itself where
+                           there is no descending facet
+  @param[out] facets2      If not NULL, the second cell of the steepest facet
+  @param[in]  halo         If not NULL, memory reused from earlier calls for
+                           the halo-padded copy of `elevations`
+*/
+template <class elev_t, class i_t>
+void dinf_receivers(Array2D<elev_t,i_t> &elevations, elev_t dx, vector<i_t> &receivers1, vector<i_t> &receivers2,
+  vector<elev_t> &partitions1, vector<elev_t> &partitions2, Array2D<elev_t,i_t> &slope,
+  vector<i_t> *facets1 = NULL, vector<i_t> *facets2 = NULL, HaloArray2D<elev_t,i_t> *halo = NULL) {
+
+  HaloArray2D<elev_t,i_t> local;
+  if(halo == NULL)
+    halo = &local;
+  halo->load(elevations);
+
+  const xy_t nx = elevations.width();
+  const xy_t ny = elevations.height();
+
+  receivers1.resize(elevations.size());
+  receivers2.resize(elevations.size());
+  partitions1.assign(elevations.size(), 0);
+  partitions2.assign(elevations.size(), 0);
+
+  for(i_t i=0; i<elevations.size(); i++) {
+    receivers1[i] = i;
+    receivers2[i] = i;
+  }
+  if(facets1 != NULL) {
+    *facets1 = receivers1;
+    *facets2 = receivers2;
+  }
 
-      next_x1 = next_x2;
-      next_y1 = next_y2;
-      next_x2 = (this_x-1 == -1) ? nx - 1 : this_x - 1;
-      next_y2 = this_y;
-      update_dinf(this_x, this_y, next_x1, next_y1, next_x2, next_y2, dx, elevations, maxSlope, max_next_x1, max_next_y1, max_next_x2, max_next_y2, partition1, partition2);
+  //Neighbour k, and neighbour k+1 after it round the cell
+  typename HaloArray2D<elev_t,i_t>::offset_t offsets[9];
+  for(int k=0; k<9; k++)
+    offsets[k] = halo->offset(neighbour_x[k%8], neighbour_y[k%8]);
 
-      // Facet 5:
+  for(xy_t this_y=1; this_y<ny-1; this_y++) {
+    const elev_t *z = halo->row(this_y);
+    for(xy_t this_x=0; this_x<nx; this_x++) {
 
-      next_x1 = next_x2;
-      next_y1 = next_y2;
-      next_x2 = (this_x-1 == -1) ? nx - 1 : this_x - 1;;
-      next_y2 = this_y + 1;
-      update_dinf(this_x, this_y, next_x1, next_y1, next_x2, next_y2, dx, elevations, maxSlope, max_next_x1, max_next_y1, max_next_x2, max_next_y2, partition1, partition2);
+      const elev_t e0 = z[this_x];
+      elev_t maxSlope = -1.0;
+      elev_t partition1 = 0;
+      elev_t partition2 = 0;
+      int max_facet = -1;
 
+      //Facets 6, 7, 8, 1, 2, 3, 4 and 5 of Tarboton (1997)
+      for(int k=0; k<8; k++)
+        update_dinf(k, e0, z[this_x+offsets[k]], z[this_x+offsets[k+1]], dx, maxSlope, max_facet, partition1, partition2);
 
       if(maxSlope > 0) {
-        area(max_next_x1, max_next_y1) += area(this_x, this_y)*partition1;
-        area(max_next_x2, max_next_y2) += area(this_x, this_y)*partition2;
+        const i_t i  = elevations.xyToI(this_x, this_y);
+        const i_t n1 = neighbour_i<i_t>(this_x, this_y, max_facet, nx);
+        const i_t n2 = neighbour_i<i_t>(this_x, this_y, (max_facet+1)%8, nx);
+        if(z[this_x+offsets[max_facet]] < e0) {
+          receivers1[i]  = n1;
+          partitions1[i] = partition1;
+        }
+        if(z[this_x+offsets[max_facet+1]] < e0) {
+          receivers2[i]  = n2;
+          partitions2[i] = partition2;
+        }
+        if(facets1 != NULL) {
+          (*facets1)[i] = n1;
+          (*facets2)[i] = n2;
+        }
         slope(this_x, this_y) = maxSlope;
       }
-    }
 
+    }
   }
 
 }
 
+/**
+  @brief D-infinity drainage area and slope.
+
+  @param[in] flood_order  If not NULL, the order recorded by
+                          priority_flood_epsilon() when filling `elevations`.
+                          It replaces sorting the flow graph.
+  @param[in] scratch      If not NULL, memory reused from earlier calls
+  @param[in] facets       Whether to record the steepest facets in
+                          scratch->facets1 and scratch->facets2
+*/
+template <class elev_t, class i_t>
+void area_slope_dinf(Array2D<elev_t,i_t> &elevations, elev_t dx, Array2D<elev_t,i_t> &area, Array2D<elev_t,i_t> &slope, const vector<i_t> *flood_order = NULL, FlowScratch<elev_t,i_t> *scratch = NULL, bool facets = false) {
+
+  FlowScratch<elev_t,i_t> local;
+  if(scratch == NULL)
+    scratch = &local;
+  vector<i_t> &receivers1     = scratch->receivers;
+  vector<i_t> &receivers2     = scratch->receivers2;
+  vector<i_t> &order          = scratch->stack;
+  vector<elev_t> &partitions1 = scratch->partitions1;
+  vector<elev_t> &partitions2 = scratch->partitions2;
+
+  if(facets)
+    dinf_receivers(elevations, dx, receivers1, receivers2, partitions1, partitions2, slope, &scratch->facets1, &scratch->facets2, &scratch->halo);
+  else
+    dinf_receivers(elevations, dx, receivers1, receivers2, partitions1, partitions2, slope, (vector<i_t>*)NULL, (vector<i_t>*)NULL, &scratch->halo);
+
+  auto push = [&](i_t i) {
+    if(receivers1[i] != i)
+      area(receivers1[i]) += area(i)*partitions1[i];
+    if(receivers2[i] != i)
+      area(receivers2[i]) += area(i)*partitions2[i];
+  };
+
+  if(flood_order != NULL) {
+    for(auto k = flood_order->rbegin(); k != flood_order->rend(); ++k)
+      push(*k);
+    return;
+  }
 
-template <class elev_t>
-void length_(Array2D<elev_t> &elevations, elev_t dx, Array2D<elev_t> &length) {
-
-  vector<elev_t> v = elevations.getDataVector();
-  vector<size_t> indices(v.size());
-  iota(indices.begin(), indices.end(), 0);
-  sort(indices.begin(), indices.end(),
-              [&v](int left, int right) -> bool {
-                  // sort indices according to corresponding array element
-                  return v[left] < v[right];
-              });
-  reverse(indices.begin(), indices.end());
-
-  xy_t nx, ny;
-
-  nx = elevations.width();
-  ny = elevations.height();
-
-  for (auto i: indices) {
-
-    xy_t this_x, this_y, next_x, next_y, max_next_x, max_next_y;
-
-    elevations.iToxy(i, this_x, this_y);
-
-    elev_t maxSlope = 0;
-
-    if( (this_y != 0) && (this_y != (ny-1))) {
-
-      next_x = (this_x-1 == -1) ? nx - 1 : this_x - 1;
-      next_y = this_y + 1;
-      update(this_x, this_y, next_x, next_y, dx, elevations, maxSlope, max_next_x, max_next_y);
-
-      next_x = this_x;
-      next_y = this_y + 1;
-      update(this_x, this_y, next_x, next_y, dx, elevations, maxSlope, max_next_x, max_next_y);
+  build_order(receivers1, receivers2, order, scratch->ndonors);
+  for(auto i: order)
+    push(i);
 
-      next_x = (this_x+1 == nx) ? 0 : this_x + 1;
-      next_y = this_y + 1;
-      update(this_x, this_y, next_x, next_y, dx, elevations, maxSlope, max_next_x, max_next_y);
+}
 
-      next_x = (this_x+1 == nx) ? 0 : this_x + 1;
-      next_y = this_y;
-      update(this_x, this_y, next_x, next_y, dx, elevations, maxSlope, max_next_x, max_next_y);
+/**
+  @brief How area_slope_mfd() shares a cell's area among its lower neighbours.
+*/
+enum MfdWeighting {
+  MFD_FREEMAN = 0,  ///< In proportion to S^p (Freeman, 1991, used p = 1.1)
+  MFD_QUINN   = 1   ///< In proportion to (L S)^p, L the contour length: dx/2
+                    ///< across a cardinal edge, 0.354 dx across a diagonal
+                    ///< (Quinn et al., 1991, used p = 1)
+};
+
+/**
+  @brief Multiple-flow-direction drainage area and slope.
+
+  Every cell sends its area to all of its lower neighbours, wrapping
+  periodically in x, in proportion to weights set by `weighting` and the
+  exponent `p`. Cells are visited in descending elevation, and each one's
+  eight slopes and weights are found as fixed-width arrays, so that the
+  arithmetic vectorises. The top and bottom rows are base level and keep
+  their area.
+
+  @param[out] slope        Slope towards the steepest lower neighbour, where
+                           there is one
+  @param[in]  p            Exponent of the weights, greater than 0. Larger
+                           values concentrate flow on the steepest descent.
+  @param[in]  flood_order  If not NULL, the order recorded by
+                           priority_flood_epsilon() when filling `elevations`.
+                           It replaces sorting the cells by elevation.
+  @param[in]  scratch      If not NULL, memory reused from earlier calls
+*/
+template <class elev_t, class i_t>
+void area_slope_mfd(Array2D<elev_t,i_t> &elevations, elev_t dx, Array2D<elev_t,i_t> &area, Array2D<elev_t,i_t> &slope, elev_t p = 1.1, MfdWeighting weighting = MFD_FREEMAN, const vector<i_t> *flood_order = NULL, FlowScratch<elev_t,i_t> *scratch = NULL) {
+
+  FlowScratch<elev_t,i_t> local;
+  if(scratch == NULL)
+    scratch = &local;
+
+  const xy_t nx = elevations.width();
+  const xy_t ny = elevations.height();
+  const elev_t *z = elevations.getData();
+  elev_t *a = area.getData();
+  elev_t *s = slope.getData();
+
+  elev_t inverse_distance[8], contour[8];
+  for(int k=0; k<8; k++) {
+    const bool diagonal = neighbour_x[k] != 0 && neighbour_y[k] != 0;
+    inverse_distance[k] = diagonal ? 1/(std::sqrt(2)*dx) : 1/dx;
+    if(weighting == MFD_QUINN)
+      contour[k] = diagonal ? 0.354*dx : 0.5*dx;
+    else
+      contour[k] = 1;
+  }
 
-      next_x = (this_x+1 == nx) ? 0 : this_x + 1;
-      next_y = this_y - 1;
-      update(this_x, this_y, next_x, next_y, dx, elevations, maxSlope, max_next_x, max_next_y);
+  auto push = [&](i_t i) {
+    const xy_t y = i/nx;
+    if(y == 0 || y == ny-1)
+      return;
+    const xy_t x  = i - (i_t)y*nx;
+    const xy_t xl = (x > 0)    ? x-1 : nx-1;
+    const xy_t xr = (x < nx-1) ? x+1 : 0;
+    const i_t above = (i_t)(y+1)*nx, row = (i_t)y*nx, below = (i_t)(y-1)*nx;
+    const i_t neighbours[8] = {above+xl, above+x, above+xr, row+xr, below+xr, below+x, below+xl, row+xl};
+
+    elev_t drop[8], weights[8];
+    for(int k=0; k<8; k++)
+      drop[k] = z[i] - z[neighbours[k]];
+    elev_t steepest = 0, largest = 0;
+    for(int k=0; k<8; k++) {
+      drop[k] = (drop[k] > 0) ? drop[k]*inverse_distance[k] : 0;
+      weights[k] = drop[k]*contour[k];
+      steepest = std::max(steepest, drop[k]);
+      largest  = std::max(largest, weights[k]);
+    }
+    if(largest <= 0)
+      return;
+    s[i] = steepest;
+
+    //Scaled by the largest weight, so that large p neither overflows nor
+    //underflows
+    for(int k=0; k<8; k++)
+      weights[k] /= largest;
+    if(p != 1)
+      for(int k=0; k<8; k++)
+        weights[k] = (weights[k] > 0) ? std::pow(weights[k], p) : 0;
+    elev_t total = 0;
+    for(int k=0; k<8; k++)
+      total += weights[k];
+
+    const elev_t share = a[i]/total;
+    for(int k=0; k<8; k++)
+      a[neighbours[k]] += share*weights[k];
+  };
+
+  if(flood_order != NULL) {
+    for(auto k = flood_order->rbegin(); k != flood_order->rend(); ++k)
+      push(*k);
+    return;
+  }
 
-      next_x = this_x;
-      next_y = this_y - 1;
-      update(this_x, this_y, next_x, next_y, dx, elevations, maxSlope, max_next_x, max_next_y);
+  vector<i_t> &order = scratch->stack;
+  order.resize(elevations.size());
+  for(i_t i=0; i<order.size(); i++)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&](i_t i, i_t j) { return z[i] > z[j]; });
+  for(auto i: order)
+    push(i);
 
-      next_x = (this_x - 1 == -1) ? nx-1 : this_x - 1;
-      next_y = this_y - 1;
-      update(this_x, this_y, next_x, next_y, dx, elevations, maxSlope, max_next_x, max_next_y);
+}
 
-      next_x = (this_x - 1 == -1) ? nx-1 : this_x - 1;
-      next_y = this_y;
-      update(this_x, this_y, next_x, next_y, dx, elevations, maxSlope, max_next_x, max_next_y);
 
-      if(length(max_next_x, max_next_y) < length(this_x, this_y) + (((this_x == next_x) || (this_y == next_y)) ? dx : 1.414*dx)) {
-        length(max_next_x, max_next_y) = length(this_x, this_y) + (((this_x == next_x) || (this_y == next_y)) ? dx : 1.414*dx);
-      }
-    }
+/**
+  @brief Length of the longest D8 flow path reaching each cell.
+
+  @param[in] order    If not NULL, the order recorded by
+                      priority_flood_epsilon() when filling `elevations`. It
+                      replaces building the flow graph's stack.
+  @param[in] scratch  If not NULL, memory reused from earlier calls
+*/
+template <class elev_t, class i_t>
+void length_(Array2D<elev_t,i_t> &elevations, elev_t dx, Array2D<elev_t,i_t> &length, const vector<i_t> *order = NULL, FlowScratch<elev_t,i_t> *scratch = NULL) {
+
+  FlowScratch<elev_t,i_t> local;
+  if(scratch == NULL)
+    scratch = &local;
+  vector<i_t> &receivers     = scratch->receivers;
+  vector<i_t> &donor_offsets = scratch->donor_offsets;
+  vector<i_t> &donors        = scratch->donors;
+  vector<i_t> &stack         = scratch->stack;
+  Array2D<elev_t,i_t> &slope     = scratch->slope;
+  slope.resize(elevations.width(), elevations.height(), 0.0);
+
+  d8_receivers(elevations, dx, receivers, slope, &scratch->halo);
+  if(order == NULL) {
+    build_donors(receivers, donor_offsets, donors);
+    build_stack(receivers, donor_offsets, donors, stack);
+    order = &stack;
+  }
 
+  // Every step is counted as dx: the original neighbour test compared against
+  // the last neighbour probed, which always shares this cell's row.
+  for(auto k = order->rbegin(); k != order->rend(); ++k) {
+    const i_t i = *k;
+    if(receivers[i] != i && length(receivers[i]) < length(i) + dx)
+      length(receivers[i]) = length(i) + dx;
   }
 
 }
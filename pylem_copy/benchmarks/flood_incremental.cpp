@@ -0,0 +1,93 @@
+// Compares IncrementalPriorityFlood with flooding from scratch over a run of
+// calls on slightly perturbed copies of one DEM, as a solver's successive
+// right-hand side evaluations see it. Both must give the same filled surface
+// at every call.
+//
+//   g++ -O3 -std=c++11 -pthread -I.. -I/path/to/richdem/headers flood_incremental.cpp -o flood_incremental
+//   ./flood_incremental [ny nx] ...
+
+#include "priority_flood.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+static const double cell_size    = 10;
+static const int    calls        = 20;
+static const int    repeats      = 3;
+
+static double seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//As randomized_grid(): a ridge between base level rows at the top and bottom,
+//plus noise
+static void build_grid(Array2D<double> &z, int ny, int nx, double slope, double noise_level) {
+  z.resize(nx, ny);
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> noise(0, 1);
+  for(int y=0; y<ny; y++)
+  for(int x=0; x<nx; x++) {
+    const int from_base = std::min(y, ny-1-y);
+    z(x,y) = (from_base == 0) ? 0 : slope*cell_size*from_base + noise_level*noise(rng);
+  }
+}
+
+static void run(int ny, int nx, double slope, double noise_level, double perturbation) {
+  Array2D<double> z0;
+  build_grid(z0, ny, nx, slope, noise_level);
+
+  //The DEM of each call, perturbed as a solver's trial steps perturb it
+  std::vector<Array2D<double> > dems(calls, z0);
+  std::mt19937 rng(2);
+  std::uniform_real_distribution<double> step(-perturbation, perturbation);
+  for(int c=1; c<calls; c++)
+  for(uint32_t i=0; i<z0.size(); i++)
+    dems[c](i) = dems[c-1](i) + ((z0(i) == 0) ? 0 : step(rng));
+
+  std::vector<Array2D<double> > cold, warm;
+  double cold_time = 1e30, warm_time = 1e30;
+  for(int r=0; r<repeats; r++) {
+    cold = dems;
+    PriorityFloodScratch<double> scratch;
+    auto start = std::chrono::steady_clock::now();
+    for(int c=0; c<calls; c++)
+      priority_flood_epsilon<double,GridCellZ_pq<double>,uint32_t>(cold[c], NULL, &scratch);
+    cold_time = std::min(cold_time, seconds(start));
+
+    warm = dems;
+    IncrementalPriorityFlood<double> incremental;
+    start = std::chrono::steady_clock::now();
+    for(int c=0; c<calls; c++)
+      incremental(warm[c]);
+    warm_time = std::min(warm_time, seconds(start));
+  }
+
+  bool identical = true;
+  for(int c=0; c<calls; c++)
+  for(uint32_t i=0; i<z0.size(); i++)
+    identical = identical && cold[c](i) == warm[c](i);
+
+  std::printf("%5d x %-5d slope %.0e noise %.1f perturbation %.0e: %d calls from scratch %6.3f s, incremental %6.3f s, speedup %5.2f, identical %s\n",
+    ny, nx, slope, noise_level, perturbation, calls, cold_time, warm_time, cold_time/warm_time, identical ? "True" : "False");
+}
+
+int main(int argc, char **argv) {
+  std::vector<std::pair<int,int> > sizes = {{1000, 1000}, {2000, 2000}};
+  if(argc > 2) {
+    sizes.clear();
+    for(int a=1; a+1<argc; a+=2)
+      sizes.emplace_back(std::atoi(argv[a]), std::atoi(argv[a+1]));
+  }
+
+  //A smooth ridge has no pits; noise adds many, and without the ridge the
+  //whole surface is pits. Perturbations below float epsilon leave the pits
+  //as they are; larger ones keep changing them.
+  const double grids[3][2] = {{5E-3, 0}, {5E-3, 1}, {0, 1}};
+  for(const auto &s: sizes)
+    for(const auto &g: grids)
+      for(double perturbation: {1E-9, 1E-4})
+        run(s.first, s.second, g[0], g[1], perturbation);
+}
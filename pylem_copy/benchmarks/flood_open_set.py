@@ -0,0 +1,34 @@
+# Compares the binary heap and radix heap open sets of Priority-Flood+Epsilon
+# on grids from randomized_grid, with and without NoData cells scattered
+# through the interior. Both must give the same filled surface.
+
+from pylem import randomized_grid
+from pylem.pypf import flood
+import numpy as np
+import time
+
+dx = 10
+slope = 5E-3
+repeats = 3
+no_data = -9999.0
+
+for (ny, nx) in [(500, 500), (1000, 1000), (2000, 2000), (2000, 4000)]:
+    for (noise_level, holes) in [(0.0, 0), (1.0, 0), (1.0, 1000)]:
+        z0 = randomized_grid((ny, nx), slope = slope*dx, noise_level = noise_level)
+        rng = np.random.default_rng(1)
+        z0[rng.integers(1, ny-1, holes), rng.integers(0, nx, holes)] = no_data
+
+        times = {}
+        filled = {}
+        for radix in [False, True]:
+            best = float('inf')
+            for r in range(repeats):
+                z = np.copy(z0)
+                start = time.perf_counter()
+                flood(z, radix = radix, no_data = no_data)
+                best = min(best, time.perf_counter() - start)
+            times[radix] = best
+            filled[radix] = z
+
+        print('{0:>5d} x {1:<5d} noise {2:.1f} NoData {3:<4d}: heap {4:.3f} s, radix {5:.3f} s, speedup {6:.2f}, identical {7}'.format(
+            ny, nx, noise_level, holes, times[False], times[True], times[False]/times[True], np.array_equal(filled[False], filled[True])))
@@ -0,0 +1,36 @@
+# Compares tile-parallel Priority-Flood+Epsilon with the serial flood on grids
+# from randomized_grid, with and without NoData cells scattered through the
+# interior. The tiled flood must give exactly the serial filled surface;
+# grids with NoData are flooded serially, so they show no speedup.
+
+from pylem import randomized_grid
+from pylem.pypf import flood
+import numpy as np
+import time
+
+dx = 10
+slope = 5E-3
+repeats = 3
+no_data = -9999.0
+
+for (ny, nx) in [(300, 200), (1000, 1000), (2000, 4000)]:
+    for (noise_level, holes) in [(0.0, 0), (1.0, 0), (1.0, 1), (1.0, 20)]:
+        z0 = randomized_grid((ny, nx), slope = slope*dx, noise_level = noise_level)
+        rng = np.random.default_rng(1)
+        z0[rng.integers(1, ny-1, holes), rng.integers(0, nx, holes)] = no_data
+
+        for radix in [False, True]:
+            times = {}
+            filled = {}
+            for threads in [1, 4]:
+                best = float('inf')
+                for r in range(repeats):
+                    z = np.copy(z0)
+                    start = time.perf_counter()
+                    flood(z, threads = threads, radix = radix, no_data = no_data)
+                    best = min(best, time.perf_counter() - start)
+                times[threads] = best
+                filled[threads] = z
+
+            print('{0:>5d} x {1:<5d} noise {2:.1f} NoData {3:<2d} {4:<5s}: serial {5:.3f} s, 4 threads {6:.3f} s, speedup {7:.2f}, identical {8}'.format(
+                ny, nx, noise_level, holes, 'radix' if radix else 'heap', times[1], times[4], times[1]/times[4], np.array_equal(filled[1], filled[4])))
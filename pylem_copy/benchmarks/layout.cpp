@@ -0,0 +1,132 @@
+// Compares the row-major, blocked and Morton storage layouts of Array2D on
+// Priority-Flood+Epsilon and on the two accumulation kernels, at 8M and 64M
+// cells. The flood and the flow graph are the same in every layout, so each
+// must give the same filled surface and drainage area.
+//
+// The layout is a template parameter, so this is C++ rather than Python:
+//
+//   g++ -O3 -std=c++11 -pthread -I.. -I/path/to/richdem/headers layout.cpp -o layout
+//   ./layout [ny nx] ...
+
+#include "priority_flood.hpp"
+#include "flow_graph.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+static const double cell_size = 10;
+static const double slope     = 5E-3;
+static const int    repeats   = 3;
+
+static double seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//As randomized_grid(): a ridge between base level rows at the top and bottom,
+//plus noise
+template <class layout_t>
+void build_grid(Array2D<double,uint32_t,layout_t> &z, int ny, int nx) {
+  z.resize(nx, ny);
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> noise(0, 1);
+  for(int y=0; y<ny; y++)
+  for(int x=0; x<nx; x++) {
+    const int from_base = std::min(y, ny-1-y);
+    z(x,y) = (from_base == 0) ? 0 : slope*cell_size*from_base + noise(rng);
+  }
+}
+
+//Steepest-descent receivers, found through xy so that they suit any layout
+template <class layout_t>
+void receivers_of(const Array2D<double,uint32_t,layout_t> &z, std::vector<uint32_t> &receivers) {
+  receivers.resize(z.size());
+  for(int y=0; y<z.height(); y++)
+  for(int x=0; x<z.width(); x++) {
+    const uint32_t i = z.xyToI(x,y);
+    receivers[i] = i;
+    if(y == 0 || y == z.height()-1)
+      continue;
+    double steepest = 0;
+    for(int n=1; n<=8; n++) {
+      const int nx = (x+dx[n]+z.width()) % z.width();
+      const int ny = y+dy[n];
+      const double drop = (z(x,y) - z(nx,ny))/((dx[n] && dy[n]) ? 1.41421356*cell_size : cell_size);
+      if(drop > steepest) {
+        steepest = drop;
+        receivers[i] = z.xyToI(nx,ny);
+      }
+    }
+  }
+}
+
+//Order-independent digest of a grid, summed in xy order
+template <class layout_t, class T>
+double digest(const Array2D<double,uint32_t,layout_t> &z, const T *values) {
+  double sum = 0;
+  for(int y=0; y<z.height(); y++)
+  for(int x=0; x<z.width(); x++)
+    sum += values[z.xyToI(x,y)]*(1 + 1e-3*(x%7) + 1e-4*(y%11));
+  return sum;
+}
+
+template <class layout_t>
+void run(const char *name, int ny, int nx) {
+  Array2D<double,uint32_t,layout_t> z0, z;
+  build_grid(z0, ny, nx);
+
+  PriorityFloodScratch<double,GridCellZ_pq<double>,uint32_t,layout_t> scratch;
+  std::vector<uint32_t> order;
+  double flood = 1e30;
+  for(int r=0; r<repeats; r++) {
+    z = z0;
+    const auto start = std::chrono::steady_clock::now();
+    priority_flood_epsilon(z, &order, &scratch);
+    flood = std::min(flood, seconds(start));
+  }
+  z0.clear();
+  scratch = PriorityFloodScratch<double,GridCellZ_pq<double>,uint32_t,layout_t>();
+
+  std::vector<uint32_t> receivers, donor_offsets, donors, stack;
+  receivers_of(z, receivers);
+  std::vector<double> area(z.size());
+
+  double pushed = 1e30;
+  for(int r=0; r<repeats; r++) {
+    std::fill(area.begin(), area.end(), cell_size*cell_size);
+    const auto start = std::chrono::steady_clock::now();
+    accumulate_receivers(order, receivers, area.data());
+    pushed = std::min(pushed, seconds(start));
+  }
+  const double pushed_digest = digest(z, area.data());
+
+  double pulled = 1e30;
+  for(int r=0; r<repeats; r++) {
+    std::fill(area.begin(), area.end(), cell_size*cell_size);
+    const auto start = std::chrono::steady_clock::now();
+    build_donors(receivers, donor_offsets, donors);
+    build_stack(receivers, donor_offsets, donors, stack);
+    accumulate(stack, donor_offsets, donors, area.data());
+    pulled = std::min(pulled, seconds(start));
+  }
+
+  std::printf("%5d x %-5d %-9s flood %7.3f s, accumulate_receivers %6.3f s, donors+stack+accumulate %6.3f s | filled %.10e area %.10e %.10e\n",
+    ny, nx, name, flood, pushed, pulled, digest(z, z.getData()), pushed_digest, digest(z, area.data()));
+}
+
+int main(int argc, char **argv) {
+  std::vector<std::pair<int,int> > sizes = {{2000, 4000}, {8000, 8000}};
+  if(argc > 2) {
+    sizes.clear();
+    for(int a=1; a+1<argc; a+=2)
+      sizes.emplace_back(std::atoi(argv[a]), std::atoi(argv[a+1]));
+  }
+
+  for(const auto &s: sizes) {
+    run<RowMajorLayout>  ("row-major", s.first, s.second);
+    run<BlockedLayout<> >("blocked",   s.first, s.second);
+    run<MortonLayout<> > ("Morton",    s.first, s.second);
+  }
+}
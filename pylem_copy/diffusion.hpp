@@ -0,0 +1,148 @@
+/**
+  @file
+  @brief Implicit linear hillslope diffusion.
+
+  Integrates dz/dt = D (d2z/dx2 + d2z/dy2) on a grid which is periodic in x
+  and whose top and bottom rows are held fixed, as in build_model_dzdt().
+  Each step is split into a backward Euler step in x followed by one in y
+  (locally one-dimensional splitting). Both are unconditionally stable and
+  damp every mode, so dt is not limited by dx^2/(4D).
+
+  The x step solves a cyclic tridiagonal system along every row, the y step a
+  tridiagonal system down every column. The coefficients are the same for
+  every row and column, so the elimination factors are computed once per step
+  and the y sweeps run across whole rows at a time.
+*/
+#ifndef _diffusion_hpp_
+#define _diffusion_hpp_
+
+#include "Array2D.hpp"
+#include "parallel.hpp"
+
+#include <vector>
+
+/**
+  @brief Scratch memory for diffusion_step(). Passing the same scratch to
+         repeated steps on grids of one size lets them run without allocating.
+*/
+template <class elev_t, class i_t = uint32_t>
+struct DiffusionScratch {
+  Array2D<elev_t,i_t> half;     ///< Elevations after the x step
+  std::vector<elev_t> cx, ix;   ///< Elimination factors of the x system
+  std::vector<elev_t> ux;       ///< Sherman-Morrison vector of the x system
+  std::vector<elev_t> cy, iy;   ///< Elimination factors of the y system
+};
+
+/**
+  @brief Advances z by one implicit diffusion step.
+
+  The fixed fluxes U dx which build_model_dzdt() sets on the faces beyond the
+  top and bottom rows only change the rate of those rows, which is then set
+  to zero. Holding the rows fixed is therefore the same boundary treatment.
+
+  @param[in,out] z        Elevations. Must be at least 3 cells wide.
+  @param[in]     dx       Grid spacing
+  @param[in]     D        Diffusivity
+  @param[in]     dt       Timestep
+  @param[in]     threads  Threads to use. 0 or fewer uses all cores.
+  @param[in]     scratch  If not NULL, memory reused from earlier calls
+*/
+template <class elev_t, class i_t>
+void diffusion_step(Array2D<elev_t,i_t> &z, elev_t dx, elev_t D, elev_t dt, int threads = 1, DiffusionScratch<elev_t,i_t> *scratch = NULL) {
+  typedef typename Array2D<elev_t,i_t>::xy_t xy_t;
+
+  DiffusionScratch<elev_t,i_t> local;
+  if(scratch == NULL)
+    scratch = &local;
+
+  const xy_t nx = z.width();
+  const xy_t ny = z.height();
+  const elev_t r = D*dt/(dx*dx);
+  const elev_t b = 1 + 2*r;
+
+  //x system: b on the diagonal, -r beside it and in the corners. The corners
+  //are removed by Sherman-Morrison, with gamma = -b, leaving a tridiagonal
+  //system whose first and last diagonal entries are modified.
+  const elev_t gamma = -b;
+  std::vector<elev_t> &cx = scratch->cx;
+  std::vector<elev_t> &ix = scratch->ix;
+  std::vector<elev_t> &ux = scratch->ux;
+  cx.resize(nx);
+  ix.resize(nx);
+  ux.resize(nx);
+  for(xy_t x=0; x<nx; x++) {
+    elev_t diag = b;
+    if(x == 0)
+      diag = b - gamma;
+    else if(x == nx-1)
+      diag = b - r*r/gamma;
+    const elev_t denom = (x == 0) ? diag : diag + r*cx[x-1];
+    ix[x] = 1/denom;
+    cx[x] = -r*ix[x];
+  }
+
+  //Solves the modified tridiagonal system in place
+  auto solve_x = [&](elev_t *d) {
+    d[0] *= ix[0];
+    for(xy_t x=1; x<nx; x++)
+      d[x] = (d[x] + r*d[x-1])*ix[x];
+    for(xy_t x=nx-2; x>=0; x--)
+      d[x] -= cx[x]*d[x+1];
+  };
+
+  for(xy_t x=0; x<nx; x++)
+    ux[x] = 0;
+  ux[0]    = gamma;
+  ux[nx-1] = -r;
+  solve_x(ux.data());
+  const elev_t ux_denom = 1 + ux[0] - r*ux[nx-1]/gamma;
+
+  Array2D<elev_t,i_t> &half = scratch->half;
+  half.resize(nx, ny);
+
+  parallel_for(ny, 16, threads, [&](size_t begin, size_t end) {
+    for(xy_t y=begin; y<(xy_t)end; y++) {
+      const elev_t *in = z.getData() + (i_t)y*nx;
+      elev_t *out = half.getData() + (i_t)y*nx;
+      for(xy_t x=0; x<nx; x++)
+        out[x] = in[x];
+      if(y == 0 || y == ny-1)
+        continue;
+      solve_x(out);
+      const elev_t f = (out[0] - r*out[nx-1]/gamma)/ux_denom;
+      for(xy_t x=0; x<nx; x++)
+        out[x] -= f*ux[x];
+    }
+  });
+
+  //y system: identity rows at the top and bottom, b on the diagonal and -r
+  //beside it in between
+  std::vector<elev_t> &cy = scratch->cy;
+  std::vector<elev_t> &iy = scratch->iy;
+  cy.assign(ny, 0);
+  iy.assign(ny, 1);
+  for(xy_t y=1; y<ny-1; y++) {
+    iy[y] = 1/(b + r*cy[y-1]);
+    cy[y] = -r*iy[y];
+  }
+
+  //Every column is swept at once, a block of columns per thread. The forward
+  //pass leaves its intermediate values in z.
+  parallel_for(nx, 256, threads, [&](size_t begin, size_t end) {
+    for(xy_t y=1; y<ny-1; y++) {
+      const elev_t *d    = half.getData() + (i_t)y*nx;
+      const elev_t *prev = z.getData() + (i_t)(y-1)*nx;
+      elev_t *out = z.getData() + (i_t)y*nx;
+      for(size_t x=begin; x<end; x++)
+        out[x] = (d[x] + r*prev[x])*iy[y];
+    }
+    for(xy_t y=ny-2; y>0; y--) {
+      const elev_t *next = z.getData() + (i_t)(y+1)*nx;
+      elev_t *out = z.getData() + (i_t)y*nx;
+      for(size_t x=begin; x<end; x++)
+        out[x] -= cy[y]*next[x];
+    }
+  });
+}
+
+#endif
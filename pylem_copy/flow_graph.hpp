@@ -0,0 +1,230 @@
+/**
+  @file
+  @brief Receiver/donor graph used to order flow accumulation without sorting
+         the DEM.
+
+  Every cell stores the cell it drains to (its receiver). Cells which drain to
+  themselves are base level. From the receivers we build a donor list and
+  then an ordering in which every receiver appears before all of its donors,
+  in time linear in the number of cells. Walking that ordering backwards
+  visits cells from upstream to downstream.
+
+  Braun, J., Willett, S.D., 2013. A very efficient O(n), implicit and parallel
+  method to solve the stream power equation governing fluvial incision and
+  landscape evolution. Geomorphology 180–181, 170–179.
+*/
+#ifndef _flow_graph_hpp_
+#define _flow_graph_hpp_
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include "parallel.hpp"
+
+/**
+  @brief Builds the donor lists of a single-receiver flow graph in compressed
+         row form.
+
+  @param[in]  receivers      Receiver of every cell. Base level cells are their
+                             own receivers.
+  @param[out] donor_offsets  Donors of cell i are donors[donor_offsets[i]] to
+                             donors[donor_offsets[i+1]-1]
+  @param[out] donors         Concatenated donor lists
+*/
+template <class i_t>
+void build_donors(const std::vector<i_t> &receivers, std::vector<i_t> &donor_offsets, std::vector<i_t> &donors) {
+
+  const i_t size = receivers.size();
+
+  donor_offsets.assign(size+1, 0);
+  for(i_t i=0; i<size; i++)
+    if(receivers[i] != i)
+      donor_offsets[receivers[i]+1]++;
+
+  for(i_t i=0; i<size; i++)
+    donor_offsets[i+1] += donor_offsets[i];
+
+  //Filling a cell's list advances its offset to the start of the next list,
+  //so the offsets are shifted back afterwards
+  donors.resize(donor_offsets[size]);
+  for(i_t i=0; i<size; i++)
+    if(receivers[i] != i)
+      donors[donor_offsets[receivers[i]]++] = i;
+
+  for(i_t i=size; i>0; i--)
+    donor_offsets[i] = donor_offsets[i-1];
+  donor_offsets[0] = 0;
+}
+
+/**
+  @brief Builds the Braun & Willett (2013) stack of a single-receiver flow
+         graph.
+
+  The stack is built by a breadth-first walk up the donor tree of every base
+  level cell, so the cells of each basin are contiguous. Every cell is placed
+  after its receiver, so iterating the stack from the back visits donors
+  before their receivers.
+
+  @param[in]  receivers      Receiver of every cell
+  @param[in]  donor_offsets  As produced by build_donors()
+  @param[in]  donors         As produced by build_donors()
+  @param[out] stack          Cells ordered from base level upstream
+*/
+template <class i_t>
+void build_stack(const std::vector<i_t> &receivers, const std::vector<i_t> &donor_offsets, const std::vector<i_t> &donors, std::vector<i_t> &stack) {
+
+  const i_t size = receivers.size();
+
+  stack.clear();
+  stack.reserve(size);
+
+  //stack doubles as the queue of cells whose donors are still to be added
+  for(i_t i=0; i<size; i++) {
+    if(receivers[i] != i)
+      continue;
+    stack.push_back(i);
+    for(i_t k=stack.size()-1; k<stack.size(); k++) {
+      const i_t c = stack[k];
+      for(i_t d=donor_offsets[c]; d<donor_offsets[c+1]; d++)
+        stack.push_back(donors[d]);
+    }
+  }
+}
+
+/**
+  @brief Orders the cells of a two-receiver flow graph (such as D-infinity) so
+         that every cell precedes its receivers.
+
+  This is Kahn's topological sort. Cells with no donors are emitted first and
+  a receiver is emitted once all of its donors have been. Edges from a cell to
+  itself are ignored. The graph must be acyclic, which holds when every edge
+  points strictly downhill.
+
+  @param[in]  receivers1  First receiver of every cell
+  @param[in]  receivers2  Second receiver of every cell
+  @param[out] order       Cells ordered from upstream to downstream
+  @param[out] ndonors     Scratch space for donor counts
+*/
+template <class i_t>
+void build_order(const std::vector<i_t> &receivers1, const std::vector<i_t> &receivers2, std::vector<i_t> &order, std::vector<uint8_t> &ndonors) {
+
+  const i_t size = receivers1.size();
+
+  ndonors.assign(size, 0);
+  for(i_t i=0; i<size; i++) {
+    if(receivers1[i] != i)
+      ndonors[receivers1[i]]++;
+    if(receivers2[i] != i)
+      ndonors[receivers2[i]]++;
+  }
+
+  order.clear();
+  order.reserve(size);
+  for(i_t i=0; i<size; i++)
+    if(ndonors[i] == 0)
+      order.push_back(i);
+
+  //order doubles as the queue of cells whose donors have all been emitted
+  for(i_t k=0; k<order.size(); k++) {
+    const i_t c = order[k];
+    if(receivers1[c] != c && --ndonors[receivers1[c]] == 0)
+      order.push_back(receivers1[c]);
+    if(receivers2[c] != c && --ndonors[receivers2[c]] == 0)
+      order.push_back(receivers2[c]);
+  }
+}
+
+/**
+  @brief Accumulates a quantity down a single-receiver flow graph.
+
+  Each cell pulls the totals of its donors, in donor-list order, once all of
+  them are final. The sum at every cell is therefore formed in the same order
+  whichever way cells are scheduled, which makes the result independent of
+  the number of threads.
+
+  @param[in]     stack          As produced by build_stack()
+  @param[in]     donor_offsets  As produced by build_donors()
+  @param[in]     donors         As produced by build_donors()
+  @param[in,out] area           Per-cell contribution on entry; accumulated
+                                total on exit
+*/
+template <class i_t, class area_t>
+void accumulate(const std::vector<i_t> &stack, const std::vector<i_t> &donor_offsets, const std::vector<i_t> &donors, area_t *area) {
+
+  for(auto k = stack.rbegin(); k != stack.rend(); ++k) {
+    const i_t c = *k;
+    for(i_t d=donor_offsets[c]; d<donor_offsets[c+1]; d++)
+      area[c] += area[donors[d]];
+  }
+}
+
+/**
+  @brief Accumulates a quantity down a single-receiver flow graph by pushing
+         each cell's total to its receiver.
+
+  Unlike accumulate(), no donor lists are needed, so any ordering in which
+  receivers precede their donors can be used directly, such as the one
+  recorded by priority_flood_epsilon().
+
+  @param[in]     order      Cells ordered from base level upstream
+  @param[in]     receivers  Receiver of every cell
+  @param[in,out] area       Per-cell contribution on entry; accumulated total
+                            on exit
+*/
+template <class i_t, class area_t>
+void accumulate_receivers(const std::vector<i_t> &order, const std::vector<i_t> &receivers, area_t *area) {
+
+  for(auto k = order.rbegin(); k != order.rend(); ++k) {
+    const i_t c = *k;
+    if(receivers[c] != c)
+      area[receivers[c]] += area[c];
+  }
+}
+
+/**
+  @brief Multithreaded accumulate() using donor-count dependency scheduling.
+
+  Every cell keeps an atomic count of donors not yet finished. Threads start
+  from cells with no donors and walk downstream. A thread which finishes the
+  last donor of a receiver carries on with that receiver; the others stop and
+  pick up a new source cell. No locks are taken, and the result is bit-for-bit
+  that of accumulate().
+
+  @param[in]     receivers      Receiver of every cell
+  @param[in]     donor_offsets  As produced by build_donors()
+  @param[in]     donors         As produced by build_donors()
+  @param[in,out] area           Per-cell contribution on entry; accumulated
+                                total on exit
+  @param[in]     nthreads       Threads to use. 0 or fewer uses all cores.
+*/
+template <class i_t, class area_t>
+void accumulate_parallel(const std::vector<i_t> &receivers, const std::vector<i_t> &donor_offsets, const std::vector<i_t> &donors, area_t *area, int nthreads) {
+
+  const i_t size = receivers.size();
+
+  std::vector<std::atomic<uint8_t> > remaining(size);
+  std::vector<i_t> sources;
+  for(i_t i=0; i<size; i++) {
+    remaining[i].store(donor_offsets[i+1]-donor_offsets[i], std::memory_order_relaxed);
+    if(donor_offsets[i+1] == donor_offsets[i])
+      sources.push_back(i);
+  }
+
+  parallel_for(sources.size(), 4096, nthreads, [&](size_t begin, size_t end) {
+    for(size_t s=begin; s<end; s++) {
+      i_t c = sources[s];
+      while(true) {
+        for(i_t d=donor_offsets[c]; d<donor_offsets[c+1]; d++)
+          area[c] += area[donors[d]];
+        const i_t r = receivers[c];
+        //The release half publishes area[c]; the acquire half lets the thread
+        //finishing the last donor see every other donor's total
+        if(r == c || remaining[r].fetch_sub(1, std::memory_order_acq_rel) != 1)
+          break;
+        c = r;
+      }
+    }
+  });
+}
+
+#endif
@@ -0,0 +1,172 @@
+/**
+  @file
+  @brief D8 area, slope, flow length, receivers, flow codes and filled DEM
+         from one fill and one traversal.
+
+  d8_outputs() computes any subset of what pyasc(), pylc() and a separate
+  fill would, filling, ordering and routing once. Work for outputs not asked
+  for is skipped: the accumulation pass runs only for area or length, and
+  the receiver pass only for receivers or codes.
+*/
+#ifndef _flow_outputs_hpp_
+#define _flow_outputs_hpp_
+
+#include "flow_workspace.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/**
+  @brief Bits of the output mask of d8_outputs().
+*/
+enum FlowOutput {
+  FLOW_AREA      = 1,   ///< Drainage area, as pyasc()
+  FLOW_SLOPE     = 2,   ///< D8 slope, as pyasc()
+  FLOW_LENGTH    = 4,   ///< Longest flow path, as pylc()
+  FLOW_RECEIVERS = 8,   ///< i-coordinate of each cell's receiver, or its own
+  FLOW_FILLED    = 16,  ///< The filled DEM
+  FLOW_D8        = 32   ///< D8 codes, as ESRI: 1 east, 2 south-east (next
+                        ///< row), 4 south, ... 128 north-east; 0 for none
+};
+
+/**
+  @brief Caller buffers for d8_outputs(), of the grid's size. Only those
+         named in the mask are used.
+*/
+template <class elev_t>
+struct FlowOutputBuffers {
+  elev_t   *area      = NULL;
+  elev_t   *slope     = NULL;
+  elev_t   *length    = NULL;
+  int64_t  *receivers = NULL;
+  elev_t   *filled    = NULL;
+  uint8_t  *d8        = NULL;
+};
+
+/**
+  @brief ESRI code of the step from (x, y) to (rx, ry). A step of more than
+         one column is taken to wrap around the periodic x edge.
+*/
+inline uint8_t d8_code(xy_t x, xy_t y, xy_t rx, xy_t ry) {
+  int dx = rx - x;
+  if(dx > 1)
+    dx = -1;
+  else if(dx < -1)
+    dx = 1;
+  const int dy = ry - y;
+  static const uint8_t codes[3][3] = {
+    {32, 64, 128},   //Previous row: north-west, north, north-east
+    {16,  0,   1},   //This row: west, none, east
+    { 8,  4,   2}    //Next row: south-west, south, south-east
+  };
+  return codes[dy+1][dx+1];
+}
+
+/**
+  @brief Fills `dem` and computes the outputs selected by `mask`.
+
+  Results are identical to those of the separate entry points.
+
+  @param[in]     mask         FlowOutput bits
+  @param[out]    out          Caller buffers
+  @param[in]     threads      Threads used for the fill
+  @param[in]     incremental  If not NULL, the warm-started flood to use
+  @param[in,out] ws           Buffers reused between calls
+*/
+template <class elev_t, class i_t>
+void d8_outputs(const Array2D<elev_t,i_t> &dem, elev_t dx, unsigned mask, const FlowOutputBuffers<elev_t> &out, int threads, typename FlowWorkspace<elev_t,i_t>::Flood *incremental, FlowWorkspace<elev_t,i_t> &ws) {
+
+  const xy_t nx = dem.width();
+  const xy_t ny = dem.height();
+  const i_t size = dem.size();
+
+  //Fill straight into the caller's buffer if the filled DEM is wanted
+  Array2D<elev_t,i_t> filled_view;
+  Array2D<elev_t,i_t> *filled = &ws.filled;
+  const std::vector<i_t> *flood_order;
+  if(mask & FLOW_FILLED) {
+    filled_view = Array2D<elev_t,i_t>(out.filled, nx, ny);
+    filled = &filled_view;
+    flood_order = ws.fill(dem, filled_view, threads, incremental);
+  } else {
+    flood_order = ws.fill(dem, threads, incremental);
+  }
+
+  const bool route = mask & (FLOW_AREA | FLOW_SLOPE | FLOW_LENGTH | FLOW_RECEIVERS | FLOW_D8);
+  if(!route)
+    return;
+
+  //Slopes go to the caller's buffer, or are found and discarded
+  Array2D<elev_t,i_t> slope_view;
+  Array2D<elev_t,i_t> *slope = &ws.flow.slope;
+  if(mask & FLOW_SLOPE) {
+    slope_view = Array2D<elev_t,i_t>(out.slope, nx, ny);
+    slope = &slope_view;
+  } else {
+    ws.flow.slope.resize(nx, ny);
+  }
+  slope->setAll(0.0);
+
+  std::vector<i_t> &receivers = ws.flow.receivers;
+  d8_receivers(*filled, dx, receivers, *slope, &ws.flow.halo);
+
+  if(mask & (FLOW_RECEIVERS | FLOW_D8)) {
+    for(i_t i=0; i<size; i++) {
+      if(mask & FLOW_RECEIVERS)
+        out.receivers[i] = receivers[i];
+      if(mask & FLOW_D8) {
+        xy_t x, y, rx, ry;
+        filled->iToxy(i, x, y);
+        filled->iToxy(receivers[i], rx, ry);
+        out.d8[i] = d8_code(x, y, rx, ry);
+      }
+    }
+  }
+
+  const bool area_wanted   = mask & FLOW_AREA;
+  const bool length_wanted = mask & FLOW_LENGTH;
+  if(!area_wanted && !length_wanted)
+    return;
+
+  elev_t *area   = out.area;
+  elev_t *length = out.length;
+  if(area_wanted)
+    std::fill(area, area+size, dx*dx);
+  if(length_wanted)
+    std::fill(length, length+size, 0);
+
+  //Area and length share one pass, pushed down the flood order as
+  //accumulate_receivers() and length_() do, or pulled up the stack from the
+  //donors as accumulate() does
+  if(flood_order != NULL) {
+    for(auto k = flood_order->rbegin(); k != flood_order->rend(); ++k) {
+      const i_t c = *k;
+      const i_t r = receivers[c];
+      if(r == c)
+        continue;
+      if(area_wanted)
+        area[r] += area[c];
+      if(length_wanted && length[r] < length[c] + dx)
+        length[r] = length[c] + dx;
+    }
+    return;
+  }
+
+  std::vector<i_t> &donor_offsets = ws.flow.donor_offsets;
+  std::vector<i_t> &donors        = ws.flow.donors;
+  std::vector<i_t> &stack         = ws.flow.stack;
+  build_donors(receivers, donor_offsets, donors);
+  build_stack(receivers, donor_offsets, donors, stack);
+  for(auto k = stack.rbegin(); k != stack.rend(); ++k) {
+    const i_t c = *k;
+    for(i_t d=donor_offsets[c]; d<donor_offsets[c+1]; d++) {
+      if(area_wanted)
+        area[c] += area[donors[d]];
+      if(length_wanted && length[c] < length[donors[d]] + dx)
+        length[c] = length[donors[d]] + dx;
+    }
+  }
+}
+
+#endif
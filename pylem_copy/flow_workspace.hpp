@@ -0,0 +1,75 @@
+/**
+  @file
+  @brief Buffers kept between calls of the flow routing entry points.
+*/
+#ifndef _flow_workspace_hpp_
+#define _flow_workspace_hpp_
+
+#include "area_slope.hpp"
+#include "priority_flood.hpp"
+#include "diffusion.hpp"
+
+#include <algorithm>
+#include <vector>
+
+/**
+  @brief Owns every buffer needed to fill a DEM and route flow over it.
+
+  Reusing one workspace for repeated calls on grids of the same shape, such
+  as successive evaluations of a model's time derivative, lets the serial
+  fill and flow routing run without allocating or touching fresh pages.
+*/
+template <class elev_t, class i_t = uint32_t>
+class FlowWorkspace {
+ public:
+  ///Warm-started flood for grids of this workspace's index type
+  typedef IncrementalPriorityFlood<elev_t, GridCellZ_pq<elev_t>, i_t> Flood;
+
+  Array2D<elev_t,i_t> filled;           ///< Filled copy of the last DEM
+  std::vector<i_t> order;               ///< Flood order of `filled`
+  PriorityFloodScratch<elev_t, GridCellZ_pq<elev_t>, i_t> flood;
+  FlowScratch<elev_t,i_t> flow;
+  Array2D<elev_t,i_t> area;             ///< Drainage area found by model_dzdt()
+  Array2D<elev_t,i_t> slope;            ///< Slope found by model_dzdt()
+  DiffusionScratch<elev_t,i_t> diffusion;
+  std::vector<elev_t> area_adjoint;     ///< Adjoints found by ks_misfit()
+  std::vector<elev_t> filled_adjoint;
+  Array2D<elev_t,i_t> padded;           ///< Grid built by ks_misfit_values()
+  std::vector<elev_t> padded_gradient;
+
+  /**
+    @brief Copies `dem` into `filled` and fills it.
+
+    @param[in] threads      Threads used by a fill from scratch
+    @param[in] incremental  If not NULL, the warm-started flood to use
+
+    @return The flood order of `filled`, or NULL if the fill used does not
+            record one
+  */
+  const std::vector<i_t> *fill(const Array2D<elev_t,i_t> &dem, int threads, Flood *incremental) {
+    filled = dem;
+    return fill(filled, filled, threads, incremental);
+  }
+
+  /**
+    @brief As fill(), but fills `target`, which may be a view of the caller's
+           buffer, in place of `filled`. `target` must have the shape of
+           `dem`, and may share its storage.
+  */
+  const std::vector<i_t> *fill(const Array2D<elev_t,i_t> &dem, Array2D<elev_t,i_t> &target, int threads, Flood *incremental) {
+    if(target.begin() != dem.begin())
+      std::copy(dem.begin(), dem.end(), target.begin());
+    if(incremental != NULL) {
+      (*incremental)(target, threads);
+      return NULL;
+    } else if(threads == 1) {
+      priority_flood_epsilon(target, &order, &flood);
+      return &order;
+    } else {
+      priority_flood_epsilon_tiled(target, threads);
+      return NULL;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,121 @@
+/**
+  @file
+  @brief A copy of a raster with a ghost halo, for stencil kernels.
+*/
+#ifndef _halo_grid_hpp_
+#define _halo_grid_hpp_
+
+#include "Array2D.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+  @brief A raster stored with a one-cell ghost halo around it, each row
+         starting on a 64-byte boundary.
+
+  Once updateHalo() has refreshed the halo, every cell, including those on
+  the raster's edges, has its eight neighbours at the same fixed offsets from
+  it, given by offset(). Stencil loops then need no bounds checks and no
+  wrap-around at the periodic x edge.
+
+  The halo's columns are the periodic images of the last and first columns.
+  Its rows copy the first and last rows. These are base level, so a stencil
+  sees no gradient across them.
+
+  @tparam T  Cell type
+  @tparam I  i-addressing type of the rasters loaded into it
+*/
+template <class T, class I = uint32_t>
+class HaloArray2D {
+ public:
+  typedef int32_t        xy_t;       ///< xy-addressing data type
+  typedef I              i_t;        ///< i-addressing data type
+  typedef std::ptrdiff_t offset_t;   ///< Distance between cells
+
+  static const size_t ALIGNMENT = 64; ///< Alignment of each row, in bytes
+
+ private:
+  std::vector<T> storage;
+  T       *origin = nullptr;         ///< Cell (0,0)
+  xy_t     view_width  = 0;
+  xy_t     view_height = 0;
+  offset_t stride = 0;               ///< Distance between rows, in cells
+
+ public:
+  /**
+    @brief Shapes the grid for a raster of the given size. The halo is not
+           refreshed. Does nothing if the grid already has this shape.
+  */
+  void resize(xy_t width, xy_t height){
+    if(origin!=nullptr && width==view_width && height==view_height)
+      return;
+
+    //Each row is a whole number of cache lines. The first line of a row ends
+    //with the row's western ghost cell, so that the row's first cell starts
+    //the second line.
+    const offset_t line = std::max<offset_t>(1, ALIGNMENT/sizeof(T));
+    stride      = line + (width+1+line-1)/line*line;
+    view_width  = width;
+    view_height = height;
+
+    storage.assign((height+2)*stride + line, T());
+    const uintptr_t base    = reinterpret_cast<uintptr_t>(storage.data());
+    const uintptr_t aligned = (base+ALIGNMENT-1)/ALIGNMENT*ALIGNMENT;
+    origin = storage.data() + (aligned-base)/sizeof(T) + stride + line;
+  }
+
+  ///Copies a raster into the grid and refreshes the halo
+  void load(const Array2D<T,I> &raster){
+    resize(raster.width(), raster.height());
+    const T *src = raster.getData();
+    for(xy_t y=0;y<view_height;y++)
+      std::copy(src+(i_t)y*view_width, src+(i_t)(y+1)*view_width, row(y));
+    updateHalo();
+  }
+
+  /**
+    @brief Refreshes the halo from the raster's edges: periodic in x, and
+           copying the first and last rows in y.
+
+    Call after writing cells on the raster's edges, before a stencil reads
+    their neighbours.
+  */
+  void updateHalo(){
+    if(view_width==0 || view_height==0)
+      return;
+    for(xy_t y=0;y<view_height;y++){
+      T *r = row(y);
+      r[-1]         = r[view_width-1];
+      r[view_width] = r[0];
+    }
+    std::copy(row(0)-1,             row(0)+view_width+1,             row(-1)-1);
+    std::copy(row(view_height-1)-1, row(view_height-1)+view_width+1, row(view_height)-1);
+  }
+
+  ///Width of the raster, without the halo
+  xy_t width()  const { return view_width;  }
+
+  ///Height of the raster, without the halo
+  xy_t height() const { return view_height; }
+
+  ///Distance between the starts of successive rows, in cells
+  offset_t rowStride() const { return stride; }
+
+  ///Distance from a cell to its neighbour (x+dx, y+dy), in cells
+  offset_t offset(int dx, int dy) const { return dy*stride + dx; }
+
+  ///@{ Cell (0,y). Rows -1 and height() are the halo.
+  T*       row(xy_t y)       { return origin + y*stride; }
+  const T* row(xy_t y) const { return origin + y*stride; }
+  ///@}
+
+  ///@{ Cell (x,y), which may lie in the halo
+  T&       operator()(xy_t x, xy_t y)       { return origin[y*stride+x]; }
+  const T& operator()(xy_t x, xy_t y) const { return origin[y*stride+x]; }
+  ///@}
+};
+
+#endif
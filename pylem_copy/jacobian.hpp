@@ -0,0 +1,158 @@
+/**
+  @file
+  @brief Sparse Jacobian of the model's time derivative.
+
+  The time derivative computed by model_dzdt() at a cell depends on the cell
+  itself and its eight neighbours only: the diffusion term on the five-point
+  stencil, and the erosion term -K A^m S on the slope S of the cell's steepest
+  D-infinity facet. The Jacobian is therefore stored with a fixed pattern of
+  nine entries per row, which holds whatever the flow graph, so that stiff
+  integrators can factorise it symbolically once.
+
+  The analytic values are those of the frozen flow graph: the fill, the
+  receivers, the partitions and hence the drainage area A are held fixed, and
+  only S varies with z. Cells raised by the fill do not follow their own
+  elevation, so derivatives with respect to them, and of their own erosion,
+  are zero.
+*/
+#ifndef _jacobian_hpp_
+#define _jacobian_hpp_
+
+#include "flow_workspace.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/**
+  @brief Number of entries in the pattern built by dzdt_sparsity().
+*/
+inline size_t dzdt_nnz(int32_t nx, int32_t ny) {
+  return (ny > 2) ? 9*(size_t)nx*(ny-2) : 0;
+}
+
+/**
+  @brief Builds the sparsity pattern of the Jacobian of model_dzdt() in
+         compressed sparse row form.
+
+  Rows of the top and bottom rows of the grid, whose derivative is always
+  zero, are empty. Every other row holds the cell and its eight neighbours,
+  wrapping around in x, in increasing column order.
+
+  @param[in]  nx, ny   Grid size; nx must be at least 3
+  @param[out] indptr   nx*ny+1 values. Row i is indices[indptr[i]] to
+                       indices[indptr[i+1]-1].
+  @param[out] indices  dzdt_nnz() column indices
+*/
+template <class idx_t>
+void dzdt_sparsity(int32_t nx, int32_t ny, idx_t *indptr, idx_t *indices) {
+
+  const size_t size = (size_t)nx*ny;
+
+  size_t k = 0;
+  for(int32_t y=0; y<ny; y++)
+  for(int32_t x=0; x<nx; x++) {
+    indptr[(size_t)y*nx+x] = k;
+    if(y == 0 || y == ny-1)
+      continue;
+    int32_t cols[3] = {(x > 0) ? x-1 : nx-1, x, (x < nx-1) ? x+1 : 0};
+    std::sort(cols, cols+3);
+    for(int32_t yy=y-1; yy<=y+1; yy++)
+      for(int c=0; c<3; c++)
+        indices[k++] = (size_t)yy*nx + cols[c];
+  }
+  indptr[size] = k;
+}
+
+/**
+  @brief Evaluates the Jacobian of model_dzdt() with the flow graph frozen at z.
+
+  @param[in]     z, dx, K, D, m  As for model_dzdt(); uplift does not enter
+  @param[in]     threads       Threads to use for the fill
+  @param[in]     incremental   If not NULL, the warm-started flood to use
+  @param[in,out] ws            Buffers reused between calls
+  @param[out]    indptr, indices  As built by dzdt_sparsity()
+  @param[out]    data          dzdt_nnz() values of the entries
+*/
+template <class elev_t, class i_t, class idx_t>
+void dzdt_jacobian(const Array2D<elev_t,i_t> &z, elev_t dx, elev_t K, elev_t D, elev_t m, int threads, typename FlowWorkspace<elev_t,i_t>::Flood *incremental, FlowWorkspace<elev_t,i_t> &ws, idx_t *indptr, idx_t *indices, elev_t *data) {
+
+  const xy_t nx = z.width();
+  const xy_t ny = z.height();
+
+  ws.area.resize(nx, ny);
+  ws.slope.resize(nx, ny);
+  ws.area.setAll(dx*dx);
+  ws.slope.setAll(0.0);
+
+  const std::vector<i_t> *flood_order = ws.fill(z, threads, incremental);
+  area_slope_dinf(ws.filled, dx, ws.area, ws.slope, flood_order, &ws.flow, true);
+  const Array2D<elev_t,i_t> &filled = ws.filled;
+
+  dzdt_sparsity(nx, ny, indptr, indices);
+  std::fill(data, data+dzdt_nnz(nx, ny), 0);
+
+  //Adds v to the entry of row i at column j, which is always in the pattern
+  auto add = [&](i_t i, i_t j, elev_t v) {
+    const idx_t *begin = &indices[indptr[i]];
+    const idx_t *at = std::find(begin, begin+9, (idx_t)j);
+    data[indptr[i] + (at-begin)] += v;
+  };
+
+  //The diffusion stencil, as in pylem.py
+  const elev_t d = D/(dx*dx);
+  for(xy_t y=1; y<ny-1; y++)
+  for(xy_t x=0; x<nx; x++) {
+    const i_t i = z.xyToI(x, y);
+    add(i, i, -4*d);
+    add(i, z.xyToI((x > 0) ? x-1 : nx-1, y), d);
+    add(i, z.xyToI((x < nx-1) ? x+1 : 0, y), d);
+    add(i, z.xyToI(x, y-1), d);
+    add(i, z.xyToI(x, y+1), d);
+  }
+
+  //The erosion term. The slope's three cases are those of update_dinf(): the
+  //facet's cardinal edge, its diagonal edge, or the plane through the cell,
+  //its cardinal neighbour c and its diagonal neighbour g.
+  const std::vector<i_t> &facets1 = ws.flow.facets1;
+  const std::vector<i_t> &facets2 = ws.flow.facets2;
+  for(xy_t y=1; y<ny-1; y++)
+  for(xy_t x=0; x<nx; x++) {
+    const i_t i = z.xyToI(x, y);
+    if(ws.slope(i) <= 0 || filled(i) != z(i))
+      continue;
+
+    xy_t x1, y1;
+    filled.iToxy(facets1[i], x1, y1);
+    const bool diagonal1 = (x1 != x) && (y1 != y);
+    const i_t c = diagonal1 ? facets2[i] : facets1[i];
+    const i_t g = diagonal1 ? facets1[i] : facets2[i];
+
+    const elev_t s1 = (filled(i) - filled(c))/dx;
+    const elev_t s2 = (filled(c) - filled(g))/dx;
+    elev_t di, dc, dg;
+    if(s2 < 0) {
+      di = 1/dx;
+      dc = -1/dx;
+      dg = 0;
+    } else if(atan2(s2, s1) > atan2(1,1)) {
+      di = 1/(std::sqrt(2)*dx);
+      dc = 0;
+      dg = -1/(std::sqrt(2)*dx);
+    } else {
+      const elev_t S = std::sqrt(s1*s1 + s2*s2);
+      di = s1/(S*dx);
+      dc = (s2-s1)/(S*dx);
+      dg = -s2/(S*dx);
+    }
+
+    const elev_t f = -K*std::pow(ws.area(i), m);
+    add(i, i, f*di);
+    if(filled(c) == z(c))
+      add(i, c, f*dc);
+    if(filled(g) == z(g))
+      add(i, g, f*dg);
+  }
+}
+
+#endif
@@ -0,0 +1,276 @@
+/**
+  @file
+  @brief Native time-stepping driver for the landscape evolution model.
+
+  LandscapeEvolutionModel owns the grid, the model parameters and every
+  buffer the kernels need, and advances the model by operator splitting:
+  uplift and stream-power erosion by stream_power_step(), hillslope diffusion
+  by diffusion_step(). Both are implicit, so the timestep is limited only by
+  accuracy. Snapshots are copied out at the requested times as the run
+  passes them. A run can be started on a background thread and polled.
+
+  A long run can also checkpoint: each snapshot is then saved to disk as it
+  is taken, with the time and step count it was taken at, and resume()
+  restores the model from the last one saved. Snapshots need not be kept in
+  memory at all, which at 4000 x 2000 cells and a thousand output times would
+  take 64 GB.
+*/
+#ifndef _landscape_model_hpp_
+#define _landscape_model_hpp_
+
+#include "flow_workspace.hpp"
+#include "stream_power.hpp"
+#include "diffusion.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+  @brief Order in which the split operators are applied within a step.
+*/
+enum Splitting {
+  SPLIT_LIE    = 0,  ///< Erosion over dt, then diffusion over dt
+  SPLIT_STRANG = 1   ///< Diffusion over dt/2, erosion over dt, diffusion over dt/2
+};
+
+/**
+  @brief Grid, parameters and state of one model run.
+*/
+template <class elev_t, class i_t = uint32_t>
+class LandscapeEvolutionModel {
+ public:
+  Array2D<elev_t,i_t> z;  ///< Elevations; the top and bottom rows are base level
+  elev_t dx;              ///< Grid spacing
+  elev_t K, U, D, m;      ///< As returned by calc_K_U_D() in pylem.py, and the area exponent
+  int threads;            ///< Threads used by the diffusion step
+  Splitting splitting;
+
+  /**
+    If not empty, snapshot n is also saved by saveNative() to
+    checkpoint+"_<n>.ras", and a line "n t steps" is then appended to
+    checkpoint+".log". n counts on across runs and resumes.
+  */
+  std::string checkpoint;
+
+ private:
+  FlowWorkspace<elev_t,i_t> ws;
+  std::thread worker;
+  std::atomic<double> time;
+  std::atomic<long>   steps;
+  std::atomic<int>    snapshots_taken;
+  std::atomic<bool>   running;
+  std::atomic<bool>   stop_requested;
+  long checkpoints_saved;
+  std::exception_ptr failure;  ///< Why the last background run ended early
+
+ public:
+  LandscapeEvolutionModel(const Array2D<elev_t,i_t> &z0, elev_t dx, elev_t K, elev_t U, elev_t D, elev_t m, int threads = 1)
+    : z(z0), dx(dx), K(K), U(U), D(D), m(m), threads(threads), splitting(SPLIT_STRANG),
+      time(0), steps(0), snapshots_taken(0), running(false), stop_requested(false),
+      checkpoints_saved(0) {}
+
+  ~LandscapeEvolutionModel() {
+    stop();
+  }
+
+  LandscapeEvolutionModel(const LandscapeEvolutionModel&) = delete;
+  LandscapeEvolutionModel& operator=(const LandscapeEvolutionModel&) = delete;
+
+  double t()              const { return time.load();            }
+  long   stepsTaken()     const { return steps.load();           }
+  int    snapshotsTaken() const { return snapshots_taken.load(); }
+  bool   isRunning()      const { return running.load();         }
+
+  /**
+    @brief Sets the model time. Only valid while no run is in progress.
+  */
+  void setTime(double t0) { time.store(t0); }
+
+  /**
+    @brief Advances the model by one split step of length dt.
+  */
+  void step(elev_t dt) {
+    if(splitting == SPLIT_STRANG) {
+      diffusion_step(z, dx, D, dt/2, threads, &ws.diffusion);
+      stream_power_step(z, dx, K, U, m, dt, ws);
+      diffusion_step(z, dx, D, dt/2, threads, &ws.diffusion);
+    } else {
+      stream_power_step(z, dx, K, U, m, dt, ws);
+      diffusion_step(z, dx, D, dt, threads, &ws.diffusion);
+    }
+    time.store(time.load() + dt);
+    steps++;
+  }
+
+  /**
+    @brief Runs the model through each time in t_eval, copying z into
+           snapshots when it is reached.
+
+    Steps are of length dt, except that the step before each snapshot is
+    shortened to land on it. Snapshot times not after the current time take
+    z as it is.
+
+    @param[in]  t_eval     Snapshot times, in increasing order
+    @param[in]  dt         Timestep. Must be positive, or the run would never
+                           reach t_eval.
+    @param[out] snapshots  t_eval.size() grids of z.size() values, row-major,
+                           or NULL to keep none in memory
+
+    @throws std::invalid_argument if dt is not positive, and
+            std::runtime_error if a checkpoint cannot be written
+  */
+  void run(const std::vector<double> &t_eval, elev_t dt, elev_t *snapshots) {
+    check_timestep(dt);
+    stop_requested.store(false);
+    snapshots_taken.store(0);
+    advance(t_eval, dt, snapshots);
+  }
+
+  /**
+    @brief As run(), but on a background thread. Returns immediately.
+           snapshots must outlive the run, which stop() can end early,
+           between steps. If the run fails, wait() throws why.
+  */
+  void start(const std::vector<double> &t_eval, elev_t dt, elev_t *snapshots) {
+    check_timestep(dt);
+    stop();
+    stop_requested.store(false);
+    snapshots_taken.store(0);
+    running.store(true);
+    failure = nullptr;
+    worker = std::thread([this, t_eval, dt, snapshots]() {
+      try {
+        advance(t_eval, dt, snapshots);
+      } catch(...) {
+        failure = std::current_exception();
+      }
+    });
+  }
+
+  /**
+    @brief Waits for a run started by start() to finish, and rethrows what
+           ended it if it failed.
+  */
+  void wait() {
+    if(worker.joinable())
+      worker.join();
+    if(failure) {
+      std::exception_ptr e = failure;
+      failure = nullptr;
+      std::rethrow_exception(e);
+    }
+  }
+
+  /**
+    @brief Asks a run to end after its current step and waits for it.
+  */
+  void stop() {
+    if(!worker.joinable())
+      return;
+    stop_requested.store(true);
+    worker.join();
+  }
+
+  /**
+    @brief Restores z, the time and the step count from the last snapshot
+           saved to a checkpoint, and carries on saving to it. Only valid
+           while no run is in progress.
+
+    @param[in] from  Checkpoint written by an earlier run of a model of the
+                     same size
+
+    @throws std::runtime_error if there is no snapshot to restore
+  */
+  void resume(const std::string &from) {
+    //The last complete line names the last snapshot saved
+    std::ifstream log(from + ".log");
+    long   n = -1, s = 0;
+    double t = 0;
+    long   ln, ls;
+    double lt;
+    while(log >> ln >> lt >> ls) {
+      n = ln;
+      t = lt;
+      s = ls;
+    }
+    if(n < 0)
+      throw std::runtime_error("No checkpoint to resume from in '" + from + ".log'");
+
+    Array2D<elev_t,i_t> saved;
+    saved.loadNative(checkpointFile(from, n));
+    if(saved.width() != z.width() || saved.height() != z.height())
+      throw std::runtime_error("Checkpoint '" + checkpointFile(from, n) + "' does not match the model's grid");
+    std::copy(saved.begin(), saved.end(), z.begin());
+
+    checkpoint        = from;
+    checkpoints_saved = n+1;
+    time.store(t);
+    steps.store(s);
+  }
+
+ private:
+  static void check_timestep(elev_t dt) {
+    if(!(dt > 0))
+      throw std::invalid_argument("LandscapeEvolutionModel: dt must be positive");
+  }
+
+  static std::string checkpointFile(const std::string &prefix, long n) {
+    return prefix + "_" + std::to_string(n) + ".ras";
+  }
+
+  //The raster is complete on disk before the log names it, so a run killed
+  //part way through a save resumes from the snapshot before
+  void saveCheckpoint() {
+    const std::string file = checkpointFile(checkpoint, checkpoints_saved);
+    z.saveNative(file + ".tmp");
+    if(std::rename((file + ".tmp").c_str(), file.c_str()) != 0)
+      throw std::runtime_error("Failed to write checkpoint '" + file + "'");
+
+    std::ofstream log(checkpoint + ".log", std::ios::app);
+    log << checkpoints_saved << ' ' << std::setprecision(std::numeric_limits<double>::max_digits10) << t() << ' ' << stepsTaken() << std::endl;
+    if(!log.good())
+      throw std::runtime_error("Failed to write checkpoint log '" + checkpoint + ".log'");
+    checkpoints_saved++;
+  }
+
+  void advance(const std::vector<double> &t_eval, elev_t dt, elev_t *snapshots) {
+    running.store(true);
+    for(size_t k=0; k<t_eval.size(); k++) {
+      //The last step lands on t_eval[k] exactly, whatever the rounding
+      while(t() < t_eval[k] && !stop_requested.load()) {
+        const double remaining = t_eval[k] - t();
+        if(remaining <= dt) {
+          step(remaining);
+          time.store(t_eval[k]);
+        } else {
+          step(dt);
+        }
+      }
+      if(stop_requested.load())
+        break;
+      if(snapshots != NULL)
+        std::copy(z.begin(), z.end(), snapshots + k*z.size());
+      if(!checkpoint.empty()) {
+        try {
+          saveCheckpoint();
+        } catch(...) {
+          running.store(false);
+          throw;
+        }
+      }
+      snapshots_taken++;
+    }
+    running.store(false);
+  }
+};
+
+#endif
@@ -0,0 +1,220 @@
+/**
+  @file
+  @brief Channel steepness misfit of a DEM and its gradient.
+
+  The misfit is the one minimised by create_optimization_function() in
+  model.py:
+
+    sqrt(mean((A^theta S - ks)^2)) + w sum((filled - z)^4)
+
+  with D-infinity area A and slope S of the filled DEM, over every row but
+  the first and last. The gradient is found by reverse-mode differentiation
+  in one backward sweep over the flood order. It holds the fill and each
+  cell's steepest facet fixed, but follows the facet slope and the partition
+  of flow between the facet's two cells, and hence the drainage area, as
+  they move with z.
+*/
+#ifndef _misfit_hpp_
+#define _misfit_hpp_
+
+#include "flow_workspace.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/**
+  @brief The parts of the misfit, for reporting.
+*/
+template <class elev_t>
+struct KsMisfitTerms {
+  elev_t rms;       ///< RMS of A^theta S - ks
+  elev_t mean_ks;   ///< Mean of A^theta S
+  elev_t penalty;   ///< Unweighted sum of (filled - z)^4
+};
+
+/**
+  @brief Evaluates the misfit and, optionally, its gradient.
+
+  The gradient ignores how filled elevations move with the depressions' spill
+  points, so in the penalty term they are taken as fixed.
+
+  @param[in]     z          DEM, including the base level rows
+  @param[in]     dx         Grid spacing
+  @param[in]     ks         Target channel steepness
+  @param[in]     theta      Concavity
+  @param[in]     weight     Weight of the filled-DEM penalty
+  @param[out]    gradient   If not NULL, the gradient with respect to z,
+                            z.size() values; zero on the first and last rows
+  @param[in,out] ws         Buffers reused between calls
+  @param[out]    terms      If not NULL, the parts of the misfit
+
+  @return The misfit
+*/
+template <class elev_t, class i_t>
+elev_t ks_misfit(const Array2D<elev_t,i_t> &z, elev_t dx, elev_t ks, elev_t theta, elev_t weight, elev_t *gradient, FlowWorkspace<elev_t,i_t> &ws, KsMisfitTerms<elev_t> *terms = NULL) {
+
+  const xy_t nx = z.width();
+  const xy_t ny = z.height();
+  const i_t size = z.size();
+
+  ws.area.resize(nx, ny);
+  ws.slope.resize(nx, ny);
+  ws.area.setAll(dx*dx);
+  ws.slope.setAll(0.0);
+
+  const std::vector<i_t> &order = *ws.fill(z, 1, NULL);
+  area_slope_dinf(ws.filled, dx, ws.area, ws.slope, &order, &ws.flow, gradient != NULL);
+  const Array2D<elev_t,i_t> &filled = ws.filled;
+  const Array2D<elev_t,i_t> &area   = ws.area;
+  const Array2D<elev_t,i_t> &slope  = ws.slope;
+
+  const i_t first = nx, last = size-nx;
+  const elev_t count = last-first;
+
+  elev_t sse = 0, sum = 0, penalty = 0;
+  for(i_t i=first; i<last; i++) {
+    const elev_t k = std::pow(area(i), theta)*slope(i);
+    sum += k;
+    sse += (k-ks)*(k-ks);
+  }
+  for(i_t i=0; i<size; i++) {
+    const elev_t d = filled(i) - z(i);
+    penalty += d*d*d*d;
+  }
+  const elev_t rms = std::sqrt(sse/count);
+  const elev_t misfit = rms + weight*penalty;
+  if(terms != NULL) {
+    terms->rms     = rms;
+    terms->mean_ks = sum/count;
+    terms->penalty = penalty;
+  }
+
+  if(gradient == NULL)
+    return misfit;
+
+  //Adjoints of the misfit with respect to area and to filled elevations
+  std::vector<elev_t> &lambda = ws.area_adjoint;
+  lambda.assign(size, 0);
+  std::fill(gradient, gradient+size, 0);
+  const elev_t drms = (rms > 0) ? 1/(count*rms) : 0;
+  for(i_t i=first; i<last; i++) {
+    const elev_t Ath = std::pow(area(i), theta);
+    const elev_t dks = drms*(Ath*slope(i) - ks);
+    if(area(i) > 0)
+      lambda[i] = dks*theta*Ath/area(i)*slope(i);
+    gradient[i] = dks*Ath;   //Adjoint of the slope, for now
+  }
+
+  //Area flows down the graph, so its adjoint flows up it: receivers come
+  //before their donors in the flood order
+  const std::vector<i_t> &receivers1  = ws.flow.receivers;
+  const std::vector<i_t> &receivers2  = ws.flow.receivers2;
+  const std::vector<elev_t> &partitions1 = ws.flow.partitions1;
+  const std::vector<elev_t> &partitions2 = ws.flow.partitions2;
+  for(auto k = order.begin(); k != order.end(); ++k) {
+    const i_t i = *k;
+    if(receivers1[i] != i)
+      lambda[i] += partitions1[i]*lambda[receivers1[i]];
+    if(receivers2[i] != i)
+      lambda[i] += partitions2[i]*lambda[receivers2[i]];
+  }
+
+  //Chain the slope and partition adjoints through the facet geometry of
+  //update_dinf(), onto the cell, its cardinal neighbour c and its diagonal
+  //neighbour g
+  std::vector<elev_t> &dfilled = ws.filled_adjoint;
+  dfilled.assign(size, 0);
+  const std::vector<i_t> &facets1 = ws.flow.facets1;
+  const std::vector<i_t> &facets2 = ws.flow.facets2;
+  for(i_t i=first; i<last; i++) {
+    if(slope(i) <= 0)
+      continue;
+
+    xy_t x, y, x1, y1;
+    filled.iToxy(i, x, y);
+    filled.iToxy(facets1[i], x1, y1);
+    const bool diagonal1 = (x1 != x) && (y1 != y);
+    const i_t c = diagonal1 ? facets2[i] : facets1[i];
+    const i_t g = diagonal1 ? facets1[i] : facets2[i];
+
+    const elev_t s1 = (filled(i) - filled(c))/dx;
+    const elev_t s2 = (filled(c) - filled(g))/dx;
+    const elev_t dS = gradient[i];
+
+    elev_t ds1 = 0, ds2 = 0;
+    if(s2 < 0) {
+      ds1 = dS;
+    } else if(atan2(s2, s1) > atan2(1,1)) {
+      dfilled[i] += dS/(std::sqrt(2)*dx);
+      dfilled[g] -= dS/(std::sqrt(2)*dx);
+    } else {
+      const elev_t S = std::sqrt(s1*s1 + s2*s2);
+      ds1 = dS*s1/S;
+      ds2 = dS*s2/S;
+
+      //The cardinal cell receives 1-t and the diagonal cell t, t = s2/s1,
+      //where each is a receiver
+      elev_t dt = 0;
+      const i_t rc = diagonal1 ? receivers2[i] : receivers1[i];
+      const i_t rg = diagonal1 ? receivers1[i] : receivers2[i];
+      if(rc != i)
+        dt -= lambda[c]*area(i);
+      if(rg != i)
+        dt += lambda[g]*area(i);
+      ds1 -= dt*s2/(s1*s1);
+      ds2 += dt/s1;
+    }
+
+    dfilled[i] += ds1/dx;
+    dfilled[c] += (ds2-ds1)/dx;
+    dfilled[g] -= ds2/dx;
+  }
+
+  //Cells raised by the fill do not follow z; the penalty pulls them up
+  for(i_t i=0; i<size; i++) {
+    const elev_t d = filled(i) - z(i);
+    gradient[i] = (d == 0) ? dfilled[i] : -4*weight*d*d*d;
+  }
+  for(xy_t x=0; x<nx; x++) {
+    gradient[x]      = 0;
+    gradient[last+x] = 0;
+  }
+
+  return misfit;
+}
+
+/**
+  @brief As ks_misfit(), for the flat parameter vector of the optimisation:
+         the m x n interior of the grid, which is padded with a row of zeros
+         above and below in a buffer of the workspace.
+
+  @param[in]  values    m*n interior elevations, row-major
+  @param[out] gradient  If not NULL, m*n values of the gradient with respect
+                        to values
+*/
+template <class elev_t, class i_t>
+elev_t ks_misfit_values(const elev_t *values, xy_t m, xy_t n, elev_t dx, elev_t ks, elev_t theta, elev_t weight, elev_t *gradient, FlowWorkspace<elev_t,i_t> &ws, KsMisfitTerms<elev_t> *terms = NULL) {
+
+  const i_t interior = (i_t)m*n;
+
+  ws.padded.resize(n, m+2);
+  std::fill(ws.padded.begin(), ws.padded.begin()+n, 0);
+  std::copy(values, values+interior, ws.padded.begin()+n);
+  std::fill(ws.padded.begin()+n+interior, ws.padded.end(), 0);
+
+  elev_t *padded_gradient = NULL;
+  if(gradient != NULL) {
+    ws.padded_gradient.resize(ws.padded.size());
+    padded_gradient = ws.padded_gradient.data();
+  }
+
+  const elev_t misfit = ks_misfit(ws.padded, dx, ks, theta, weight, padded_gradient, ws, terms);
+
+  if(gradient != NULL)
+    std::copy(padded_gradient+n, padded_gradient+n+interior, gradient);
+
+  return misfit;
+}
+
+#endif
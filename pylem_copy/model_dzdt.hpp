@@ -0,0 +1,92 @@
+/**
+  @file
+  @brief Time derivative of the landscape evolution model, computed natively.
+
+  The model is
+
+    dz/dt = U - div(Q) - K A^m S,    Q = -D grad(z)
+
+  on a grid which is periodic in x and whose top and bottom rows are held at
+  base level. model_dzdt() evaluates it exactly as build_model_dzdt() in
+  pylem.py does, but in one pass over the grid after routing flow, without
+  any full-grid temporaries.
+*/
+#ifndef _model_dzdt_hpp_
+#define _model_dzdt_hpp_
+
+#include "flow_workspace.hpp"
+#include "parallel.hpp"
+
+#include <cmath>
+
+/**
+  @brief Evaluates the model's time derivative.
+
+  Diffusive fluxes are taken across every cell face, wrapping around in x.
+  The faces above the top row and below the bottom row carry the fixed fluxes
+  Q - U dx which balance uplift there. Erosion uses D-infinity drainage area
+  and slope from the filled DEM. dzdt is then set to zero on the top and
+  bottom rows.
+
+  @param[in]     z          Elevations
+  @param[in]     dx         Grid spacing
+  @param[in]     K, U, D, m Erodibility, uplift rate, diffusivity and area
+                            exponent
+  @param[out]    dzdt       Time derivative; the same size as z
+  @param[in]     threads    Threads to use for the fill and the fused pass
+  @param[in]     incremental If not NULL, the warm-started flood to use
+  @param[in,out] ws         Buffers reused between calls
+*/
+template <class elev_t, class i_t>
+void model_dzdt(const Array2D<elev_t,i_t> &z, elev_t dx, elev_t K, elev_t U, elev_t D, elev_t m, Array2D<elev_t,i_t> &dzdt, int threads, typename FlowWorkspace<elev_t,i_t>::Flood *incremental, FlowWorkspace<elev_t,i_t> &ws) {
+
+  const xy_t nx = z.width();
+  const xy_t ny = z.height();
+
+  ws.area.resize(nx, ny);
+  ws.slope.resize(nx, ny);
+  ws.area.setAll(dx*dx);
+  ws.slope.setAll(0.0);
+
+  const std::vector<i_t> *flood_order = ws.fill(z, threads, incremental);
+  area_slope_dinf(ws.filled, dx, ws.area, ws.slope, flood_order, &ws.flow);
+
+  //The arithmetic follows pylem.py operation for operation. Only pow() may
+  //round differently from NumPy's, by an ulp; like NumPy, m = 1/2 uses sqrt()
+  const elev_t Udx = U*dx;
+  parallel_for(ny, 16, threads, [&](size_t begin, size_t end) {
+    for(xy_t y=begin; y<(xy_t)end; y++) {
+      const elev_t *row   = z.getData() + (i_t)y*nx;
+      const elev_t *above = (y > 0)    ? row-nx : NULL;
+      const elev_t *below = (y < ny-1) ? row+nx : NULL;
+      const elev_t *a = ws.area.getData()  + (i_t)y*nx;
+      const elev_t *s = ws.slope.getData() + (i_t)y*nx;
+      elev_t *out = dzdt.getData() + (i_t)y*nx;
+
+      for(xy_t x=0; x<nx; x++) {
+        const elev_t left  = row[(x > 0)    ? x-1 : nx-1];
+        const elev_t right = row[(x < nx-1) ? x+1 : 0];
+        const elev_t qx0 = -D*(row[x]-left)/dx;
+        const elev_t qx1 = -D*(right-row[x])/dx;
+
+        //Interior faces of the first and last rows also set their fixed
+        //boundary fluxes
+        const elev_t qy_in0 = (above != NULL) ? -D*(row[x]-above[x])/dx : 0;
+        const elev_t qy_in1 = (below != NULL) ? -D*(below[x]-row[x])/dx : 0;
+        const elev_t qy0 = (above != NULL) ? qy_in0 : qy_in1-Udx;
+        const elev_t qy1 = (below != NULL) ? qy_in1 : Udx+qy_in0;
+
+        const elev_t diffusion = -(qx1-qx0)/dx - (qy1-qy0)/dx;
+        const elev_t erosion = -K*((m == 0.5) ? std::sqrt(a[x]) : std::pow(a[x], m))*s[x];
+        out[x] = U + diffusion + erosion;
+      }
+    }
+  });
+
+  for(xy_t x=0; x<nx; x++) {
+    dzdt(x, 0)    = 0.0;
+    dzdt(x, ny-1) = 0.0;
+  }
+}
+
+#endif
@@ -0,0 +1,63 @@
+/**
+  @file
+  @brief Minimal thread pool helpers shared by the multithreaded kernels.
+*/
+#ifndef _parallel_hpp_
+#define _parallel_hpp_
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+/**
+  @brief Number of threads to use when the caller asks for 0 or fewer.
+*/
+inline int default_threads() {
+  const int n = std::thread::hardware_concurrency();
+  return (n > 0) ? n : 1;
+}
+
+/**
+  @brief Runs f(begin, end) over [0, size) in chunks of at most `chunk` items.
+
+  Chunks are handed out dynamically through an atomic cursor, so uneven work
+  per item balances itself. With one thread, f runs on the calling thread.
+
+  @param[in] size      Number of items
+  @param[in] chunk     Items per call to f
+  @param[in] nthreads  Threads to use. 0 or fewer uses default_threads().
+  @param[in] f         Callable taking (size_t begin, size_t end)
+*/
+template <class F>
+void parallel_for(size_t size, size_t chunk, int nthreads, F f) {
+
+  if(nthreads <= 0)
+    nthreads = default_threads();
+  if(chunk == 0)
+    chunk = 1;
+
+  const size_t nchunks = (size + chunk - 1)/chunk;
+  if((size_t)nthreads > nchunks)
+    nthreads = (nchunks > 0) ? nchunks : 1;
+
+  std::atomic<size_t> cursor(0);
+  auto worker = [&]() {
+    for(size_t begin = cursor.fetch_add(chunk); begin < size; begin = cursor.fetch_add(chunk))
+      f(begin, (begin + chunk < size) ? begin + chunk : size);
+  };
+
+  if(nthreads == 1) {
+    worker();
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  for(int t=1; t<nthreads; t++)
+    threads.emplace_back(worker);
+  worker();
+  for(auto &t: threads)
+    t.join();
+}
+
+#endif
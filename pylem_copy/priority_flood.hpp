@@ -7,13 +7,29 @@
 #ifndef _richdem_priority_flood_hpp_
 #define _richdem_priority_flood_hpp_
 #include "Array2D.hpp"
+#include "parallel.hpp"
+#include "radix_heap.hpp"
 #include "richdem/common/grid_cell.hpp"
 #include <queue>
+#include <vector>
+#include <algorithm>
 #include <limits>
 #include <iostream>
 #include <cstdlib> //Used for exit
 using namespace richdem;
 
+/**
+  @brief  Scratch memory for priority_flood_epsilon(). Passing the same scratch
+          to repeated floods of grids of one size lets them run without
+          allocating.
+*/
+template <class elev_t, class open_t = GridCellZ_pq<elev_t>, class i_t = uint32_t, class layout_t = RowMajorLayout>
+struct PriorityFloodScratch {
+  open_t open;                        ///< Priority queue of cells to visit
+  std::vector<GridCellZ<elev_t> > pit;  ///< FIFO of cells raised into a pit
+  Array2D<int8_t,i_t,layout_t> closed;  ///< Cells already reached
+};
+
 /**
   @brief  Modifies floating-point cell elevations to guarantee drainage.
   @author Richard Barnes (rbarnes@umn.edu)
@@ -28,6 +44,17 @@ using namespace richdem;
     way, pits are filled without incurring the expense of the priority queue.
 
   @param[in,out]  &elevations   A grid of cell elevations
+  @param[out]     order         If not NULL, receives the i-coordinate of every
+                                cell in the order the flood reached its final
+                                elevation
+  @param[in,out]  scratch       If not NULL, memory reused from earlier calls
+
+  @tparam open_t  Priority queue of GridCellZ used as the open set: the
+                  default binary heap GridCellZ_pq or RadixHeap
+  @tparam i_t     i-addressing type of the grid, and of `order`
+  @tparam layout_t  Storage layout of the grid. Cells are addressed by xy, so
+                    any layout gives the same result; a tiled one keeps the
+                    neighbours the flood visits close in memory.
 
   @pre
     1. **elevations** contains the elevations of every cell or a value _NoData_
@@ -38,11 +65,21 @@ using namespace richdem;
     1. **elevations** contains the elevations of every cell or a value _NoData_
        for cells not part of the DEM.
     2. **elevations** has no landscape depressions, digital dams, or flats.
+    3. **order**, if given, lists the data cells by non-decreasing filled
+       elevation. Read backwards, it visits donors before their receivers in
+       any flow graph whose edges lead strictly downhill.
 */
-template <class elev_t>
-void priority_flood_epsilon(Array2D<elev_t> &elevations){
-  GridCellZ_pq<elev_t> open;
-  std::queue<GridCellZ<elev_t> > pit;
+template <class elev_t, class open_t = GridCellZ_pq<elev_t>, class i_t = uint32_t, class layout_t = RowMajorLayout>
+void priority_flood_epsilon(Array2D<elev_t,i_t,layout_t> &elevations, std::vector<i_t> *order = NULL, PriorityFloodScratch<elev_t,open_t,i_t,layout_t> *scratch = NULL){
+  PriorityFloodScratch<elev_t,open_t,i_t,layout_t> local;
+  if(scratch==NULL)
+    scratch = &local;
+  open_t &open = scratch->open;
+  //A vector with a moving front serves as the pit queue. It is emptied
+  //whenever the front catches up, which keeps its memory for the next pit.
+  std::vector<GridCellZ<elev_t> > &pit = scratch->pit;
+  size_t pit_front = 0;
+  pit.clear();
   //ProgressBar progress;
   //uint64_t processed_cells = 0;
   //uint64_t pitc            = 0;
@@ -55,7 +92,13 @@ void priority_flood_epsilon(Array2D<elev_t> &elevations){
   std::cerr<<"p Setting up boolean flood array matrix..."<<std::endl;
   */
 
-  Array2D<int8_t> closed(elevations.width(),elevations.height(),false);
+  Array2D<int8_t,i_t,layout_t> &closed = scratch->closed;
+  closed.resize(elevations.width(),elevations.height(),false);
+
+  if(order!=NULL){
+    order->clear();
+    order->reserve(elevations.size());
+  }
 
   /*
   std::cerr<<"p Adding cells to the priority queue..."<<std::endl;
@@ -81,15 +124,18 @@ void priority_flood_epsilon(Array2D<elev_t> &elevations){
   std::cerr<<"p Performing Priority-Flood+Epsilon..."<<std::endl;
   progress.start( elevations.size() );
   */
-  while(open.size()>0 || pit.size()>0){
+  while(open.size()>0 || pit_front<pit.size()){
     GridCellZ<elev_t> c;
-    if(pit.size()>0 && open.size()>0 && open.top().z==pit.front().z){
+    if(pit_front<pit.size() && open.size()>0 && open.top().z<=pit[pit_front].z){
       c=open.top();
       open.pop();
       PitTop=elevations.noData();
-    } else if(pit.size()>0){
-      c=pit.front();
-      pit.pop();
+    } else if(pit_front<pit.size()){
+      c=pit[pit_front++];
+      if(pit_front==pit.size()){
+        pit.clear();
+        pit_front = 0;
+      }
       if(PitTop==elevations.noData())
         PitTop=elevations(c.x,c.y);
     } else {
@@ -99,6 +145,9 @@ void priority_flood_epsilon(Array2D<elev_t> &elevations){
     }
     //processed_cells++;
 
+    if(order!=NULL && c.z!=elevations.noData())
+      order->push_back(elevations.xyToI(c.x,c.y));
+
     for(int n=1;n<=8;n++){
       int nx=c.x+dx[n];
       // Periodic BCs:
@@ -107,58 +156,524 @@ void priority_flood_epsilon(Array2D<elev_t> &elevations){
 
       if(!elevations.inGrid(nx,ny)) continue;
 
-      if(closed(nx,ny))
+      //closed shares the grid's shape and layout, so one address serves both
+      const i_t ni = elevations.xyToI(nx,ny);
+
+      if(closed(ni))
         continue;
-      closed(nx,ny)=true;
+      closed(ni)=true;
 
-      if(elevations(nx,ny)==elevations.noData())
-        pit.push(GridCellZ<elev_t>(nx,ny,elevations.noData()));
+      if(elevations(ni)==elevations.noData())
+        pit.emplace_back(nx,ny,elevations.noData());
 
-      else if(elevations(nx,ny)<=nextafterf(c.z,std::numeric_limits<float>::infinity())){
-        if(PitTop!=elevations.noData() && PitTop<elevations(nx,ny) && nextafterf(c.z,std::numeric_limits<float>::infinity())>=elevations(nx,ny))
+      else if(elevations(ni)<=nextafterf(c.z,std::numeric_limits<float>::infinity())){
+        if(PitTop!=elevations.noData() && PitTop<elevations(ni) && nextafterf(c.z,std::numeric_limits<float>::infinity())>=elevations(ni))
           ++false_pit_cells;
         //++pitc;
-        elevations(nx,ny)=nextafterf(c.z,std::numeric_limits<float>::infinity());
-        pit.push(GridCellZ<elev_t>(nx,ny,elevations(nx,ny)));
+        elevations(ni)=nextafterf(c.z,std::numeric_limits<float>::infinity());
+        pit.emplace_back(nx,ny,elevations(ni));
       } else
-        open.emplace(nx,ny,elevations(nx,ny));
+        open.emplace(nx,ny,elevations(ni));
     }
   }
 
 }
 
 
+/**
+  @brief  Elevation a cell of elevation z takes when Priority-Flood+Epsilon
+          reaches it from a neighbour whose elevation plus epsilon is `up`.
+*/
+template <class elev_t>
+elev_t epsilon_raise(elev_t z, elev_t up, elev_t no_data){
+  if(z==no_data)
+    return z;
+  return (z<=up) ? up : z;
+}
+
+/**
+  @brief  Whether any cell off the top and bottom rows is NoData. Those rows
+          seed the flood, so NoData cells on them are reached in the same
+          order by every variant of it.
+*/
+template <class elev_t, class i_t>
+bool has_interior_no_data(const Array2D<elev_t,i_t> &elevations){
+  for(int y=1;y<elevations.height()-1;y++)
+  for(int x=0;x<elevations.width();x++)
+    if(elevations(x,y)==elevations.noData())
+      return true;
+  return false;
+}
+
+/**
+  @brief  Lowers cells of `filled` within [x0,x1)x[y0,y1) to the
+          Priority-Flood+Epsilon surface reachable from the cells in
+          `scratch.open`.
+
+    Cells are only ever lowered, so `filled` must hold upper bounds of the
+    final surface (infinity where nothing is known yet) and every queued cell
+    must hold its queued elevation. As in priority_flood_epsilon(), raised
+    cells bypass the priority queue; they are only taken first when no lower
+    cell is waiting, so that every cell is final the first time it is taken.
+    x wraps periodically; cells outside the region are neither read as
+    targets nor written.
+
+    NoData cells are not handled as priority_flood_epsilon() handles them, so
+    `dem` must have none off its top and bottom rows.
+
+  @param[in]      &dem      The unfilled DEM
+  @param[in,out]  &filled   Upper bounds of the filled DEM
+  @param[in,out]  &scratch  Its open set holds the cells to flood from. Empty
+                            on exit.
+*/
+template <class elev_t, class open_t, class i_t>
+void flood_epsilon_region(const Array2D<elev_t,i_t> &dem, Array2D<elev_t,i_t> &filled, PriorityFloodScratch<elev_t,open_t,i_t> &scratch, int x0, int x1, int y0, int y1){
+  const int width = dem.width();
+  open_t &open = scratch.open;
+  std::vector<GridCellZ<elev_t> > &pit = scratch.pit;
+  size_t pit_front = 0;
+  pit.clear();
+  while(open.size()>0 || pit_front<pit.size()){
+    GridCellZ<elev_t> c;
+    if(pit_front<pit.size() && (open.size()==0 || pit[pit_front].z<=open.top().z)){
+      c=pit[pit_front++];
+      if(pit_front==pit.size()){
+        pit.clear();
+        pit_front = 0;
+      }
+    } else {
+      c=open.top();
+      open.pop();
+    }
+    if(c.z!=filled(c.x,c.y))  //Lowered since it was queued
+      continue;
+    const elev_t up = nextafterf(c.z,std::numeric_limits<float>::infinity());
+    for(int n=1;n<=8;n++){
+      int nx=c.x+dx[n];
+      // Periodic BCs:
+      nx = (nx == width) ? 0 : (nx == -1) ? width-1 : nx;
+      int ny=c.y+dy[n];
+      if(nx<x0 || nx>=x1 || ny<y0 || ny>=y1)
+        continue;
+      const elev_t z = epsilon_raise(dem(nx,ny),up,dem.noData());
+      if(z<filled(nx,ny)){
+        filled(nx,ny)=z;
+        if(z==dem(nx,ny))
+          open.emplace(nx,ny,z);
+        else
+          pit.emplace_back(nx,ny,z);
+      }
+    }
+  }
+}
+
+
+/**
+  @brief  Tile-parallel Priority-Flood+Epsilon. Gives exactly the output of
+          priority_flood_epsilon().
+
+    Priority-Flood+Epsilon raises every cell to the lowest elevation that is
+    at least one float epsilon above some neighbour with a path to the edge.
+    That surface depends only on the DEM, not on the order in which cells are
+    visited, so it can be built tile by tile, following Barnes (2016).
+
+    Tiles are flooded independently and in parallel from the cells they own
+    on the top and bottom edges, treating their borders with other tiles as
+    walls. Each tile's border cells are then offered the spill elevations of
+    their neighbours across the border, with x wrapping periodically. Tiles
+    whose border cells were lowered are re-flooded in parallel from just
+    those cells. This repeats until no border changes. By default the tiles
+    are full-height strips, so every tile touches an outlet and one or two
+    exchanges usually suffice.
+
+    NoData cells are expanded by priority_flood_epsilon() when the flood
+    first reaches them, and their neighbours then keep their own elevations
+    unless they were reached earlier. That depends on the order in which
+    cells are visited, which tiles do not share, so a grid containing NoData
+    is flooded serially instead.
+
+    Barnes, R., 2016. Parallel priority-flood depression filling for trillion
+    cell digital elevation models on desktops or clusters. Computers &
+    Geosciences 96, 56–68. doi:10.1016/j.cageo.2016.07.001
+
+  @param[in,out]  &elevations   A grid of cell elevations
+  @param[in]      threads       Threads to use. 0 or fewer uses all cores.
+  @param[in]      tile_width    Width of a tile. 0 or fewer splits the width
+                                evenly between the threads.
+  @param[in]      tile_height   Height of a tile. 0 or fewer uses the full
+                                height.
+
+  @tparam open_t  Open set, as for priority_flood_epsilon()
+
+  @pre
+    1. **elevations** contains the elevations of every cell or a value _NoData_
+       for cells not part of the DEM. Only grids without _NoData_ cells off
+       the top and bottom rows are flooded in parallel.
+
+  @post
+    1. **elevations** is identical to the output of priority_flood_epsilon().
+*/
+template <class elev_t, class open_t = GridCellZ_pq<elev_t>, class i_t = uint32_t>
+void priority_flood_epsilon_tiled(Array2D<elev_t,i_t> &elevations, int threads = 0, int tile_width = 0, int tile_height = 0){
+  const int width  = elevations.width();
+  const int height = elevations.height();
+
+  if(has_interior_no_data(elevations)){
+    priority_flood_epsilon<elev_t,open_t,i_t>(elevations);
+    return;
+  }
+
+  if(threads<=0)
+    threads = default_threads();
+  if(tile_width<=0)
+    tile_width = std::max((width+threads-1)/threads, 1);
+  if(tile_height<=0)
+    tile_height = std::max(height, 1);
+
+  const int tiles_x = (width +tile_width -1)/tile_width;
+  const int tiles_y = (height+tile_height-1)/tile_height;
+  const int tiles   = tiles_x*tiles_y;
+
+  const Array2D<elev_t,i_t> dem(elevations);
+
+  auto in_tile = [&](int t, int x, int y) -> bool {
+    return x/tile_width==t%tiles_x && y/tile_height==t/tiles_x;
+  };
+
+  //Cells start infinitely high and are only ever lowered
+  elevations.setAll(std::numeric_limits<elev_t>::infinity());
+
+  std::vector<PriorityFloodScratch<elev_t,open_t,i_t> > scratch(tiles);
+  for(int x=0;x<width;x++){
+    elevations(x,0)        = dem(x,0);
+    elevations(x,height-1) = dem(x,height-1);
+    scratch[(x/tile_width)].open.emplace(x,0,dem(x,0));
+    scratch[((height-1)/tile_height)*tiles_x+x/tile_width].open.emplace(x,height-1,dem(x,height-1));
+  }
+
+  //Floods a tile from the cells in its queue, never leaving the tile
+  auto flood_tile = [&](int t){
+    const int x0 = (t%tiles_x)*tile_width;
+    const int y0 = std::max((t/tiles_x)*tile_height, 1);
+    const int x1 = std::min(x0+tile_width, width);
+    const int y1 = std::min((t/tiles_x+1)*tile_height, height-1);
+    flood_epsilon_region(dem, elevations, scratch[t], x0, x1, y0, y1);
+  };
+
+  std::vector<std::vector<GridCellZ<elev_t> > > offers(tiles);
+
+  while(true){
+    parallel_for(tiles, 1, threads, [&](size_t begin, size_t end){
+      for(size_t t=begin;t<end;t++)
+        flood_tile(t);
+    });
+
+    //Border cells collect offers from across the border. Nothing is written
+    //to the grid here, so tiles can read each other's borders freely.
+    parallel_for(tiles, 1, threads, [&](size_t begin, size_t end){
+      for(size_t t=begin;t<end;t++){
+        const int x0 = (t%tiles_x)*tile_width;
+        const int y0 = (t/tiles_x)*tile_height;
+        const int x1 = std::min(x0+tile_width, width);
+        const int y1 = std::min(y0+tile_height, height);
+        for(int y=std::max(y0,1);y<std::min(y1,height-1);y++)
+        for(int x=x0;x<x1;x+=(y==y0 || y==y1-1) ? 1 : std::max(x1-x0-1,1)){
+          for(int n=1;n<=8;n++){
+            int nx=x+dx[n];
+            // Periodic BCs:
+            nx = (nx == width) ? 0 : (nx == -1) ? width-1 : nx;
+            int ny=y+dy[n];
+            if(!elevations.inGrid(nx,ny) || in_tile(t,nx,ny))
+              continue;
+            if(elevations(nx,ny)==std::numeric_limits<elev_t>::infinity())
+              continue;
+            const elev_t z = epsilon_raise(dem(x,y),(elev_t)nextafterf(elevations(nx,ny),std::numeric_limits<float>::infinity()),dem.noData());
+            if(z<elevations(x,y))
+              offers[t].emplace_back(x,y,z);
+          }
+        }
+      }
+    });
+
+    bool changed = false;
+    for(int t=0;t<tiles;t++){
+      for(const auto &c: offers[t]){
+        if(c.z<elevations(c.x,c.y)){
+          elevations(c.x,c.y)=c.z;
+          scratch[t].open.push(c);
+          changed = true;
+        }
+      }
+      offers[t].clear();
+    }
+
+    if(!changed)
+      break;
+  }
+}
+
+
+/**
+  @brief  Priority-Flood+Epsilon which reuses its previous output when called
+          again on a slightly changed DEM, such as successive evaluations of a
+          model's time derivative.
+
+    Priority-Flood+Epsilon raises every cell to the lowest elevation that is
+    at least one float epsilon above some neighbour with a path to the edge,
+    and this surface is the only one in which every cell is exactly as high
+    as its lowest neighbour allows. A warm start therefore only has to find
+    the cells where the previous fill, carried over to the new DEM, breaks
+    that rule and flood from them:
+
+    1. Cells which were not raised take their new elevation; raised cells
+       keep their fill level unless the DEM rose above it.
+    2. Cells lower than their neighbours allow (a pit has formed or its
+       spill point rose) are released, along with any neighbour which then
+       becomes too low.
+    3. Cells higher than their neighbours allow (a spill point dropped) and
+       cells bordering released ones are flooded from, as in
+       priority_flood_epsilon(), until nothing changes.
+
+    When pit membership does not change, steps 2 and 3 touch no cells and a
+    call costs two passes over the grid instead of a full flood. If more than
+    an eighth of the grid is released, the call gives up and floods from
+    scratch instead. Pits usually keep changing for a while once they start,
+    so each time a warm start gives up the next 1, 2, 4, ... up to 64 calls
+    flood from scratch without trying one. The result is always identical to
+    that of priority_flood_epsilon().
+
+  @tparam open_t  Open set, as for priority_flood_epsilon()
+  @tparam i_t     i-addressing type of the grids filled
+*/
+template <class elev_t, class open_t = GridCellZ_pq<elev_t>, class i_t = uint32_t>
+class IncrementalPriorityFlood {
+ private:
+  Array2D<elev_t,i_t> dem;     ///< DEM passed to the previous call
+  Array2D<elev_t,i_t> filled;  ///< Output of the previous call
+
+  ///@{ Scratch memory kept between calls
+  std::vector<GridCell> released;
+  std::vector<GridCell> lowered;
+  PriorityFloodScratch<elev_t,open_t,i_t> scratch;
+  ///@}
+
+  int cold_calls = 0;  ///< Calls left to flood from scratch without trying
+  int backoff    = 1;  ///< Value of cold_calls after the next warm start fails
+
+  ///Lowest elevation that cell x,y may take given its neighbours' fill
+  elev_t allowed(int x, int y) const {
+    elev_t lowest = std::numeric_limits<elev_t>::infinity();
+    for(int n=1;n<=8;n++){
+      int nx=x+dx[n];
+      // Periodic BCs:
+      nx = (nx == filled.width()) ? 0 : (nx == -1) ? filled.width()-1 : nx;
+      lowest = std::min(lowest, filled(nx,y+dy[n]));
+    }
+    return epsilon_raise(dem(x,y),(elev_t)nextafterf(lowest,std::numeric_limits<float>::infinity()),dem.noData());
+  }
+
+  ///Whether some neighbour lets cell x,y keep its own, unraised, elevation
+  bool drains(int x, int y) const {
+    for(int n=1;n<=8;n++){
+      int nx=x+dx[n];
+      // Periodic BCs:
+      nx = (nx == filled.width()) ? 0 : (nx == -1) ? filled.width()-1 : nx;
+      if(nextafterf(filled(nx,y+dy[n]),std::numeric_limits<float>::infinity())<=dem(x,y))
+        return true;
+    }
+    return false;
+  }
+
+  bool borders_released(int x, int y) const {
+    for(int n=1;n<=8;n++){
+      int nx=x+dx[n];
+      // Periodic BCs:
+      nx = (nx == filled.width()) ? 0 : (nx == -1) ? filled.width()-1 : nx;
+      const int ny=y+dy[n];
+      if(filled.inGrid(nx,ny) && filled(nx,ny)==std::numeric_limits<elev_t>::infinity())
+        return true;
+    }
+    return false;
+  }
+
+  void flood(Array2D<elev_t,i_t> &elevations, int threads){
+    if(threads==1)
+      priority_flood_epsilon<elev_t,open_t,i_t>(elevations, NULL, &scratch);
+    else
+      priority_flood_epsilon_tiled<elev_t,open_t,i_t>(elevations, threads);
+  }
+
+  ///Fills `elevations` from scratch and keeps it for the next call
+  void flood_from_scratch(Array2D<elev_t,i_t> &elevations, int threads){
+    dem = elevations;
+    flood(elevations, threads);
+    filled = elevations;
+  }
+
+  ///Abandons a warm start which released too much of the surface
+  void give_up(Array2D<elev_t,i_t> &elevations, int threads){
+    cold_calls = backoff;
+    backoff    = std::min(2*backoff, 64);
+    flood(elevations, threads);
+  }
+
+ public:
+  ///Forget the previous fill; the next call floods from scratch
+  void reset(){
+    dem.clear();
+    filled.clear();
+    cold_calls = 0;
+    backoff    = 1;
+  }
+
+  /**
+    @brief Fills `elevations` in place, reusing the previous call's fill if
+           the grid has the same shape.
+
+    @param[in,out]  &elevations   A grid of cell elevations
+    @param[in]      threads       Threads used when flooding from scratch
+  */
+  void operator()(Array2D<elev_t,i_t> &elevations, int threads = 1){
+    const int width  = elevations.width();
+    const int height = elevations.height();
+    const elev_t inf = std::numeric_limits<elev_t>::infinity();
+
+    if(filled.empty() || filled.width()!=width || filled.height()!=height){
+      flood_from_scratch(elevations, threads);
+      return;
+    }
+
+    //Backing off from a failed warm start. The last of these calls keeps its
+    //fill, for the next call to try again from.
+    if(cold_calls>0){
+      if(--cold_calls>0)
+        flood(elevations, threads);
+      else
+        flood_from_scratch(elevations, threads);
+      return;
+    }
+
+    //The warm start floods with flood_epsilon_region(), which does not
+    //handle NoData off the edge rows as priority_flood_epsilon() does
+    bool interior_no_data = false;
+    dem.setNoData(elevations.noData());
+    for(i_t i=0;i<elevations.size();i++){
+      const elev_t z = elevations(i);
+      if(filled(i)==dem(i) || z==elevations.noData() || filled(i)<z)
+        filled(i) = z;
+      dem(i) = z;
+      if(z==elevations.noData() && i>=(i_t)width && i<elevations.size()-width)
+        interior_no_data = true;
+    }
+    if(interior_no_data){
+      flood_from_scratch(elevations, threads);
+      return;
+    }
+
+    //Once this many cells are released, most of the surface is being
+    //re-flooded and starting over is cheaper. Both loops below check as they
+    //go, so that a surface riddled with changed pits gives up early.
+    const size_t max_released = elevations.size()/8;
+
+    released.clear();
+    lowered.clear();
+    for(int y=1;y<height-1;y++)
+    for(int x=0;x<width;x++){
+      //An unraised cell can only be too low, and one lower neighbour is
+      //enough to show that it is not
+      if(filled(x,y)==dem(x,y) && dem(x,y)!=dem.noData() && drains(x,y))
+        continue;
+      const elev_t z = allowed(x,y);
+      if(filled(x,y)<z){
+        filled(x,y) = inf;
+        released.emplace_back(x,y);
+        if(released.size()>max_released){
+          give_up(elevations, threads);
+          return;
+        }
+      } else if(filled(x,y)>z)
+        lowered.emplace_back(x,y);
+    }
+
+    for(size_t r=0;r<released.size();r++){
+      if(released.size()>max_released){
+        give_up(elevations, threads);
+        return;
+      }
+      const GridCell c = released[r];
+      for(int n=1;n<=8;n++){
+        int nx=c.x+dx[n];
+        // Periodic BCs:
+        nx = (nx == width) ? 0 : (nx == -1) ? width-1 : nx;
+        const int ny=c.y+dy[n];
+        if(ny<=0 || ny>=height-1 || filled(nx,ny)==inf)
+          continue;
+        if(filled(nx,ny)<allowed(nx,ny)){
+          filled(nx,ny) = inf;
+          released.emplace_back(nx,ny);
+        }
+      }
+    }
+
+    open_t &open = scratch.open;
+    if(released.empty()){
+      for(const auto &c: lowered){
+        filled(c.x,c.y) = std::min(filled(c.x,c.y), allowed(c.x,c.y));
+        open.emplace(c.x,c.y,filled(c.x,c.y));
+      }
+    } else {
+      for(int y=0;y<height;y++)
+      for(int x=0;x<width;x++){
+        if(filled(x,y)==inf)
+          continue;
+        if(y>0 && y<height-1 && allowed(x,y)<filled(x,y)){
+          filled(x,y) = allowed(x,y);
+          open.emplace(x,y,filled(x,y));
+        } else if(borders_released(x,y))
+          open.emplace(x,y,filled(x,y));
+      }
+    }
+
+    flood_epsilon_region(dem, filled, scratch, 0, width, 1, height-1);
+    backoff = 1;
+
+    for(i_t i=0;i<elevations.size();i++)
+      elevations(i) = filled(i);
+  }
+};
+
+
 ///Priority-Flood+Epsilon is not available for integer data types
 template<>
-void priority_flood_epsilon(Array2D<uint8_t> &elevations){
+void priority_flood_epsilon(Array2D<uint8_t> &elevations, std::vector<uint32_t> *order, PriorityFloodScratch<uint8_t> *scratch){
   std::cerr<<"E Priority-Flood+Epsilon is only available for floating-point data types!"<<std::endl;
   exit(-1);
 }
 
 ///Priority-Flood+Epsilon is not available for integer data types
 template<>
-void priority_flood_epsilon(Array2D<uint16_t> &elevations){
+void priority_flood_epsilon(Array2D<uint16_t> &elevations, std::vector<uint32_t> *order, PriorityFloodScratch<uint16_t> *scratch){
   std::cerr<<"E Priority-Flood+Epsilon is only available for floating-point data types!"<<std::endl;
   exit(-1);
 }
 
 ///Priority-Flood+Epsilon is not available for integer data types
 template<>
-void priority_flood_epsilon(Array2D<int16_t> &elevations){
+void priority_flood_epsilon(Array2D<int16_t> &elevations, std::vector<uint32_t> *order, PriorityFloodScratch<int16_t> *scratch){
   std::cerr<<"E Priority-Flood+Epsilon is only available for floating-point data types!"<<std::endl;
   exit(-1);
 }
 
 ///Priority-Flood+Epsilon is not available for integer data types
 template<>
-void priority_flood_epsilon(Array2D<uint32_t> &elevations){
+void priority_flood_epsilon(Array2D<uint32_t> &elevations, std::vector<uint32_t> *order, PriorityFloodScratch<uint32_t> *scratch){
   std::cerr<<"E Priority-Flood+Epsilon is only available for floating-point data types!"<<std::endl;
   exit(-1);
 }
 
 ///Priority-Flood+Epsilon is not available for integer data types
 template<>
-void priority_flood_epsilon(Array2D<int32_t> &elevations){
+void priority_flood_epsilon(Array2D<int32_t> &elevations, std::vector<uint32_t> *order, PriorityFloodScratch<int32_t> *scratch){
   std::cerr<<"E Priority-Flood+Epsilon is only available for floating-point data types!"<<std::endl;
   exit(-1);
 }
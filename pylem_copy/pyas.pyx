@@ -1,33 +1,542 @@
 import numpy as np
+import os
 import copy
 cimport pyas
 cimport numpy as np
 from libc.stdlib cimport malloc, free
 
-def area_dinf(np.ndarray[double, ndim = 2, mode = 'c'] dem not None, float dx):
+cdef class FloodState:
+  """Keeps the last depression fill so that repeated calls on a slowly
+  changing DEM of the same shape only re-flood the pits that changed."""
 
-  m, n = dem.shape[0], dem.shape[1]
-  cdef np.ndarray[double, ndim = 2, mode = 'c'] a = np.zeros((m,n), dtype = float)
-  cdef np.ndarray[double, ndim = 2, mode = 'c'] s = np.zeros((m,n), dtype = float)
+  cdef void *flood
 
-  pyasc_dinf(&dem[0,0], dx, &a[0,0], &s[0,0], m, n)
+  def __cinit__(self):
+    self.flood = pyasc_flood_new()
+
+  def __dealloc__(self):
+    pyasc_flood_free(self.flood)
+
+cdef class FlowWorkspace:
+  """Keeps the scratch buffers of the flow routing functions, so that
+  repeated calls on DEMs of the same shape do not allocate."""
+
+  cdef void *workspace
+
+  def __cinit__(self):
+    self.workspace = pyasc_workspace_new()
+
+  def __dealloc__(self):
+    pyasc_workspace_free(self.workspace)
+
+cdef void *flood_ptr(FloodState flood_state):
+  return NULL if flood_state is None else flood_state.flood
+
+cdef void *workspace_ptr(FlowWorkspace workspace):
+  return NULL if workspace is None else workspace.workspace
+
+# Returns the caller's preallocated output arrays, checking their shapes, or
+# allocates new ones. out is an array, or a tuple of them if count > 1.
+cdef tuple outputs(out, tuple shape, int count):
+  if out is None:
+    return tuple(np.empty(shape, dtype = float) for i in range(count))
+  if count == 1 and not isinstance(out, tuple):
+    out = (out,)
+  if len(out) != count:
+    raise ValueError('out must hold {0} arrays'.format(count))
+  for o in out:
+    if o.shape != shape:
+      raise ValueError('out arrays must have the shape of dem')
+  return out
+
+def area_dinf(np.ndarray[double, ndim = 2, mode = 'c'] dem not None, float dx, int threads = 1, FloodState flood_state = None, out = None, FlowWorkspace workspace = None):
+
+  cdef int32_t m = dem.shape[0], n = dem.shape[1]
+  cdef np.ndarray[double, ndim = 2, mode = 'c'] a
+  cdef np.ndarray[double, ndim = 2, mode = 'c'] s
+  a, s = outputs(out, (m, n), 2)
+
+  cdef double *pdem = &dem[0,0]
+  cdef double *pa = &a[0,0]
+  cdef double *ps = &s[0,0]
+  cdef void *flood = flood_ptr(flood_state)
+  cdef void *ws = workspace_ptr(workspace)
+  with nogil:
+    pyasc_dinf(pdem, dx, pa, ps, m, n, threads, flood, ws)
+
+  return a, s
+
+def area_with_fill_dinf(np.ndarray[double, ndim = 2, mode = 'c'] dem not None, float dx, int threads = 1, FloodState flood_state = None, out = None, FlowWorkspace workspace = None):
+  """As area_dinf, also returning the filled DEM the flow was routed over:
+  (a, s, filled). out, if given, holds the three arrays; filled may be dem
+  itself to fill it in place."""
+
+  cdef int32_t m = dem.shape[0], n = dem.shape[1]
+  cdef np.ndarray[double, ndim = 2, mode = 'c'] a
+  cdef np.ndarray[double, ndim = 2, mode = 'c'] s
+  cdef np.ndarray[double, ndim = 2, mode = 'c'] filled
+  a, s, filled = outputs(out, (m, n), 3)
+
+  cdef double *pdem = &dem[0,0]
+  cdef double *pa = &a[0,0]
+  cdef double *ps = &s[0,0]
+  cdef double *pf = &filled[0,0]
+  cdef void *flood = flood_ptr(flood_state)
+  cdef void *ws = workspace_ptr(workspace)
+  with nogil:
+    pyasc_dinf_filled(pdem, dx, pa, ps, pf, m, n, threads, flood, ws)
+
+  return a, s, filled
+
+def area_mfd(np.ndarray[double, ndim = 2, mode = 'c'] dem not None, float dx, double exponent = 1.1, weighting = 'freeman', int threads = 1, FloodState flood_state = None, out = None, FlowWorkspace workspace = None):
+  """Multiple-flow-direction area and slope, periodic in x. Each cell's
+  area is shared among its lower neighbours in proportion to S^exponent
+  (weighting = 'freeman') or (L S)^exponent, L the contour length
+  (weighting = 'quinn')."""
+
+  cdef int32_t w
+  if weighting == 'freeman':
+    w = 0
+  elif weighting == 'quinn':
+    w = 1
+  else:
+    raise ValueError("weighting must be 'freeman' or 'quinn'")
+  if exponent <= 0:
+    raise ValueError('exponent must be positive')
+
+  cdef int32_t m = dem.shape[0], n = dem.shape[1]
+  cdef np.ndarray[double, ndim = 2, mode = 'c'] a
+  cdef np.ndarray[double, ndim = 2, mode = 'c'] s
+  a, s = outputs(out, (m, n), 2)
+
+  cdef double *pdem = &dem[0,0]
+  cdef double *pa = &a[0,0]
+  cdef double *ps = &s[0,0]
+  cdef void *flood = flood_ptr(flood_state)
+  cdef void *ws = workspace_ptr(workspace)
+  with nogil:
+    pyasc_mfd(pdem, dx, pa, ps, exponent, w, m, n, threads, flood, ws)
 
   return a, s
 
-def area(np.ndarray[double, ndim = 2, mode = 'c'] dem not None, float dx):
+def area(np.ndarray[double, ndim = 2, mode = 'c'] dem not None, float dx, int threads = 1, FloodState flood_state = None, out = None, FlowWorkspace workspace = None):
 
-  m, n = dem.shape[0], dem.shape[1]
-  cdef np.ndarray[double, ndim = 2, mode = 'c'] a = np.zeros((m,n), dtype = float)
-  cdef np.ndarray[double, ndim = 2, mode = 'c'] s = np.zeros((m,n), dtype = float)
+  cdef int32_t m = dem.shape[0], n = dem.shape[1]
+  cdef np.ndarray[double, ndim = 2, mode = 'c'] a
+  cdef np.ndarray[double, ndim = 2, mode = 'c'] s
+  a, s = outputs(out, (m, n), 2)
 
-  pyasc(&dem[0,0], dx, &a[0,0], &s[0,0], m, n)
+  cdef double *pdem = &dem[0,0]
+  cdef double *pa = &a[0,0]
+  cdef double *ps = &s[0,0]
+  cdef void *flood = flood_ptr(flood_state)
+  cdef void *ws = workspace_ptr(workspace)
+  with nogil:
+    pyasc(pdem, dx, pa, ps, m, n, threads, flood, ws)
 
   return a, s
 
-def length(np.ndarray[double, ndim = 2, mode = 'c'] dem not None, float dx):
-  m, n = dem.shape[0], dem.shape[1]
-  cdef np.ndarray[double, ndim = 2, mode = 'c'] l = np.zeros((m,n), dtype = float)
+def length(np.ndarray[double, ndim = 2, mode = 'c'] dem not None, float dx, int threads = 1, FloodState flood_state = None, out = None, FlowWorkspace workspace = None):
+  cdef int32_t m = dem.shape[0], n = dem.shape[1]
+  cdef np.ndarray[double, ndim = 2, mode = 'c'] l
+  l, = outputs(out, (m, n), 1)
 
-  pylc(&dem[0,0], dx, &l[0,0], m, n)
+  cdef double *pdem = &dem[0,0]
+  cdef double *pl = &l[0,0]
+  cdef void *flood = flood_ptr(flood_state)
+  cdef void *ws = workspace_ptr(workspace)
+  with nogil:
+    pylc(pdem, dx, pl, m, n, threads, flood, ws)
 
   return l
+
+# Bits of the output mask of pyasc_outputs, as FlowOutput in flow_outputs.hpp
+cdef dict FLOW_OUTPUTS = {'area': 1, 'slope': 2, 'length': 4, 'receivers': 8, 'filled': 16, 'd8': 32}
+
+def flow_outputs(np.ndarray[double, ndim = 2, mode = 'c'] dem not None, float dx, outputs = ('area', 'slope'), int threads = 1, FloodState flood_state = None, FlowWorkspace workspace = None):
+  """D8 outputs from one fill and one traversal: any of 'area', 'slope',
+  'length', 'receivers' (flat index of each cell's receiver, or its own),
+  'filled' and 'd8' (ESRI codes, 1 east to 128 north-east, rows increasing
+  southwards; 0 where a cell drains nowhere). Returns a dict of the
+  requested arrays; outputs not requested are not computed."""
+
+  cdef int32_t m = dem.shape[0], n = dem.shape[1]
+  cdef uint32_t mask = 0
+  for name in outputs:
+    if name not in FLOW_OUTPUTS:
+      raise ValueError('unknown output {0}'.format(name))
+    mask |= FLOW_OUTPUTS[name]
+
+  cdef np.ndarray[double, ndim = 2, mode = 'c'] a, s, l, f
+  cdef np.ndarray[np.int64_t, ndim = 2, mode = 'c'] r
+  cdef np.ndarray[np.uint8_t, ndim = 2, mode = 'c'] d
+  cdef double *pa = NULL
+  cdef double *ps = NULL
+  cdef double *pl = NULL
+  cdef double *pf = NULL
+  cdef int64_t *pr = NULL
+  cdef uint8_t *pd = NULL
+  result = {}
+  if mask & 1:
+    a = result['area'] = np.empty((m, n))
+    pa = &a[0,0]
+  if mask & 2:
+    s = result['slope'] = np.empty((m, n))
+    ps = &s[0,0]
+  if mask & 4:
+    l = result['length'] = np.empty((m, n))
+    pl = &l[0,0]
+  if mask & 8:
+    r = result['receivers'] = np.empty((m, n), dtype = np.int64)
+    pr = &r[0,0]
+  if mask & 16:
+    f = result['filled'] = np.empty((m, n))
+    pf = &f[0,0]
+  if mask & 32:
+    d = result['d8'] = np.empty((m, n), dtype = np.uint8)
+    pd = &d[0,0]
+
+  cdef double *pdem = &dem[0,0]
+  cdef void *flood = flood_ptr(flood_state)
+  cdef void *ws = workspace_ptr(workspace)
+  with nogil:
+    pyasc_outputs(pdem, dx, mask, pa, ps, pl, pr, pf, pd, m, n, threads, flood, ws)
+
+  return result
+
+def dzdt(np.ndarray[double, ndim = 2, mode = 'c'] z not None, double dx, double K, double U, double D, double m, int threads = 1, FloodState flood_state = None, out = None, FlowWorkspace workspace = None):
+  """Time derivative of the landscape evolution model: uplift, diffusion
+  (periodic in x) and D-infinity stream-power erosion, zero on the top and
+  bottom rows. Matches the dzdt built by pylem.build_model_dzdt."""
+
+  cdef int32_t rows = z.shape[0], cols = z.shape[1]
+  cdef np.ndarray[double, ndim = 2, mode = 'c'] rate
+  rate, = outputs(out, (rows, cols), 1)
+
+  cdef double *pz = &z[0,0]
+  cdef double *prate = &rate[0,0]
+  cdef void *flood = flood_ptr(flood_state)
+  cdef void *ws = workspace_ptr(workspace)
+  with nogil:
+    pydzdt(pz, dx, K, U, D, m, prate, rows, cols, threads, flood, ws)
+
+  return rate
+
+# Allocates the CSR arrays of the Jacobian of dzdt on a rows x cols grid
+cdef tuple csr_arrays(int32_t rows, int32_t cols):
+  if cols < 3:
+    raise ValueError('the grid must be at least 3 columns wide')
+  cdef long long nnz = 9*<long long>cols*max(rows-2, 0)
+  if nnz >= 2**31:
+    raise ValueError('the Jacobian has too many entries for 32-bit indices')
+  return np.empty(nnz), np.empty(nnz, dtype = np.int32), np.empty(rows*cols+1, dtype = np.int32)
+
+def dzdt_sparsity(tuple shape):
+  """Sparsity pattern of the Jacobian of dzdt on a grid of the given shape,
+  as CSR (indices, indptr): each cell and its eight neighbours, periodic in
+  x, with the top and bottom rows empty. It holds for every z."""
+
+  cdef int32_t rows = shape[0], cols = shape[1]
+  cdef np.ndarray[np.int32_t, ndim = 1, mode = 'c'] indices
+  cdef np.ndarray[np.int32_t, ndim = 1, mode = 'c'] indptr
+  _, indices, indptr = csr_arrays(rows, cols)
+  pyasc_sparsity(rows, cols, <int32_t *> &indptr[0], <int32_t *> indices.data)
+  return indices, indptr
+
+def dzdt_jacobian(np.ndarray[double, ndim = 2, mode = 'c'] z not None, double dx, double K, double D, double m, int threads = 1, FloodState flood_state = None, FlowWorkspace workspace = None):
+  """Jacobian of dzdt at z with the fill and flow graph frozen, as CSR
+  (data, indices, indptr) with the pattern of dzdt_sparsity."""
+
+  cdef int32_t rows = z.shape[0], cols = z.shape[1]
+  cdef np.ndarray[double, ndim = 1, mode = 'c'] data
+  cdef np.ndarray[np.int32_t, ndim = 1, mode = 'c'] indices
+  cdef np.ndarray[np.int32_t, ndim = 1, mode = 'c'] indptr
+  data, indices, indptr = csr_arrays(rows, cols)
+
+  cdef double *pz = &z[0,0]
+  cdef double *pdata = <double *> data.data
+  cdef int32_t *pindices = <int32_t *> indices.data
+  cdef int32_t *pindptr = <int32_t *> &indptr[0]
+  cdef void *flood = flood_ptr(flood_state)
+  cdef void *ws = workspace_ptr(workspace)
+  with nogil:
+    pyasc_jacobian(pz, dx, K, D, m, rows, cols, threads, flood, ws, pindptr, pindices, pdata)
+
+  return data, indices, indptr
+
+def steady_state(np.ndarray[double, ndim = 2, mode = 'c'] z not None, double dx, double K, double U, double D, double m, double tol = 1e-3, int max_newton = 50, int max_ptc = 500, int restart = 20, int max_krylov = 200, double forcing = 1e-2, double dtau0 = 0.0, bint matrix_free = False, int threads = 1, FlowWorkspace workspace = None):
+  """Solves dzdt(z) = 0 in place by Newton-Krylov, falling back to
+  pseudo-transient continuation when Newton stalls. Converged when
+  RMS(dzdt) <= tol*|U|. GMRES is preconditioned by the frozen flow graph and
+  keeps restart+1 grids. With matrix_free, Jacobian products difference
+  dzdt instead of using the frozen flow graph's Jacobian. If the solver does
+  not converge, z is the iterate with the smallest residual.
+
+  Returns (z, residuals, krylov, pseudo, converged): RMS(dzdt)/|U| at the
+  start and after every step, the GMRES iterations of every step, and
+  whether every step was pseudo-transient."""
+
+  cdef int32_t rows = z.shape[0], cols = z.shape[1]
+  if cols < 3:
+    raise ValueError('z must be at least 3 columns wide')
+  if restart < 1:
+    raise ValueError('restart must be at least 1')
+  if max_krylov < 0:
+    raise ValueError('max_krylov must not be negative')
+  cdef np.ndarray[double, ndim = 1, mode = 'c'] residuals = np.empty(max_newton + max_ptc + 1)
+  cdef np.ndarray[np.int32_t, ndim = 1, mode = 'c'] krylov = np.empty(max_newton + max_ptc + 1, dtype = np.int32)
+  cdef np.ndarray[np.int32_t, ndim = 1, mode = 'c'] pseudo = np.empty(max_newton + max_ptc + 1, dtype = np.int32)
+  cdef int32_t count, converged
+  cdef double *pz = &z[0,0]
+  cdef double *pres = &residuals[0]
+  cdef int32_t *pkrylov = <int32_t *> &krylov[0]
+  cdef int32_t *ppseudo = <int32_t *> &pseudo[0]
+  cdef void *ws = workspace_ptr(workspace)
+  with nogil:
+    count = pyasc_steady_state(pz, dx, K, U, D, m, rows, cols, tol, max_newton, max_ptc, restart, max_krylov, forcing, dtau0, matrix_free, threads, ws, pres, pkrylov, ppseudo, &converged)
+
+  return z, residuals[:count].copy(), krylov[:count-1].copy(), pseudo[:count-1].astype(bool), bool(converged)
+
+def ks_misfit(np.ndarray[double, ndim = 2, mode = 'c'] z not None, double dx, double ks, double concavity, double penalty_weight = 1e6, bint gradient = True, FlowWorkspace workspace = None):
+  """Misfit of model.create_optimization_function: the RMS of
+  A^concavity S - ks over all rows but the first and last, plus
+  penalty_weight times the sum of (filled - z)^4. With gradient, returns
+  (misfit, gradient with respect to z), found by one backward sweep with the
+  fill and the steepest facets held fixed."""
+
+  cdef int32_t rows = z.shape[0], cols = z.shape[1]
+  cdef np.ndarray[double, ndim = 2, mode = 'c'] g
+  cdef double *pz = &z[0,0]
+  cdef double *pg = NULL
+  if gradient:
+    g = np.empty((rows, cols))
+    pg = &g[0,0]
+  cdef void *ws = workspace_ptr(workspace)
+  cdef double misfit
+  with nogil:
+    misfit = pyasc_ks_misfit(pz, dx, ks, concavity, penalty_weight, rows, cols, pg, ws)
+
+  if gradient:
+    return misfit, g
+  return misfit
+
+def ks_misfit_values(np.ndarray[double, ndim = 1, mode = 'c'] values not None, shape, double dx, double ks, double concavity, double penalty_weight = 1e6, bint gradient = False, FlowWorkspace workspace = None):
+  """As ks_misfit, for the flat vector of the m x n interior of the grid,
+  shape = (m, n), which is padded with a row of zeros above and below.
+  Returns (misfit, (rms, mean ks_obs, penalty)), with the gradient with
+  respect to values appended if asked for."""
+
+  cdef int32_t rows = shape[0], cols = shape[1]
+  if values.shape[0] != rows*cols:
+    raise ValueError("values must hold m*n elevations")
+  cdef np.ndarray[double, ndim = 1, mode = 'c'] g
+  cdef double terms[3]
+  cdef double *pv = &values[0]
+  cdef double *pg = NULL
+  if gradient:
+    g = np.empty(rows*cols)
+    pg = &g[0]
+  cdef void *ws = workspace_ptr(workspace)
+  cdef double misfit
+  with nogil:
+    misfit = pyasc_ks_misfit_values(pv, dx, ks, concavity, penalty_weight, rows, cols, pg, terms, ws)
+
+  if gradient:
+    return misfit, (terms[0], terms[1], terms[2]), g
+  return misfit, (terms[0], terms[1], terms[2])
+
+def stream_power_step(np.ndarray[double, ndim = 2, mode = 'c'] z not None, double dx, double K, double U, double m, double dt, FlowWorkspace workspace = None):
+  """Advances z in place by one implicit (Braun & Willett, 2013) step of
+  uplift and stream-power erosion, stable for any dt. The top and bottom rows
+  are held fixed. Returns z."""
+
+  cdef int32_t rows = z.shape[0], cols = z.shape[1]
+  cdef double *pz = &z[0,0]
+  cdef void *ws = workspace_ptr(workspace)
+  with nogil:
+    pysp_step(pz, dx, K, U, m, dt, rows, cols, ws)
+
+  return z
+
+def diffusion_step(np.ndarray[double, ndim = 2, mode = 'c'] z not None, double dx, double D, double dt, int threads = 1, FlowWorkspace workspace = None):
+  """Advances z in place by one implicit step of linear diffusion, periodic
+  in x with the top and bottom rows held fixed, stable for any dt. Returns
+  z."""
+
+  cdef int32_t rows = z.shape[0], cols = z.shape[1]
+  if cols < 3:
+    raise ValueError('z must be at least 3 columns wide')
+  cdef double *pz = &z[0,0]
+  cdef void *ws = workspace_ptr(workspace)
+  with nogil:
+    pydiff_step(pz, dx, D, dt, rows, cols, threads, ws)
+
+  return z
+
+cdef class LandscapeEvolutionModel:
+  """Native model run: owns the grid and parameters, and advances them by
+  implicit uplift/erosion and diffusion steps with operator splitting
+  ('strang' or 'lie'). A run started with start() goes on in the background
+  and can be polled with progress. A run given a checkpoint saves each
+  snapshot to disk as it is taken, and resume() restarts from the last one."""
+
+  cdef void *model
+  cdef int32_t rows, cols
+  cdef np.ndarray snapshot_array
+  cdef np.ndarray t_eval
+
+  def __cinit__(self, np.ndarray[double, ndim = 2, mode = 'c'] z0 not None, double dx, double K, double U, double D, double m, int threads = 1, splitting = 'strang', double t0 = 0.0):
+    if splitting not in ('lie', 'strang'):
+      raise ValueError("splitting must be 'lie' or 'strang'")
+    if z0.shape[1] < 3:
+      raise ValueError('z0 must be at least 3 columns wide')
+    if <long long>z0.shape[0]*z0.shape[1] >= 0xFFFFFFFF:
+      raise ValueError('z0 has too many cells for 32-bit indices')
+    self.rows, self.cols = z0.shape[0], z0.shape[1]
+    self.model = pyasc_model_new(&z0[0,0], self.rows, self.cols, dx, K, U, D, m, threads, 1 if splitting == 'strang' else 0, t0)
+
+  def __dealloc__(self):
+    if self.model != NULL:
+      with nogil:
+        pyasc_model_free(self.model)
+
+  def start(self, t_eval, double dt, checkpoint = None, bint keep_snapshots = True):
+    """Starts running through the increasing times t_eval with steps of dt,
+    taking a snapshot of z at each, and returns at once.
+
+    If checkpoint is given, snapshot n is also saved to checkpoint_<n>.ras as
+    it is taken, and 'n t steps' appended to checkpoint.log; n counts on
+    across runs. None keeps saving to the checkpoint of an earlier run or of
+    resume(), if any, and '' stops saving. keep_snapshots=False keeps no
+    snapshots in memory."""
+    if not dt > 0:
+      raise ValueError('dt must be positive')
+    self.stop()
+    cdef np.ndarray[double, ndim = 1, mode = 'c'] times = np.ascontiguousarray(t_eval, dtype = float)
+    cdef np.ndarray[double, ndim = 3, mode = 'c'] snapshots = np.empty((len(times) if keep_snapshots else 0, self.rows, self.cols))
+    cdef bytes path = None if checkpoint is None else os.fsencode(checkpoint)
+    cdef double *psnapshots = NULL
+    cdef const char *ppath = NULL
+    self.t_eval = times
+    self.snapshot_array = snapshots if keep_snapshots else None
+    if len(times) == 0:
+      return
+    if keep_snapshots:
+      psnapshots = &snapshots[0,0,0]
+    if path is not None:
+      ppath = path
+    pyasc_model_start(self.model, &times[0], len(times), dt, psnapshots, ppath)
+
+  def resume(self, checkpoint):
+    """Restores z, t and the step count from the last snapshot saved to
+    checkpoint, and keeps saving to it. Returns t; pass start() the output
+    times after it."""
+    self.stop()
+    cdef bytes path = os.fsencode(checkpoint)
+    pyasc_model_resume(self.model, path)
+    return self.progress[0]
+
+  def wait(self):
+    """Waits for the run to finish. Raises the error that ended it, if
+    saving a checkpoint failed."""
+    with nogil:
+      pyasc_model_wait(self.model)
+
+  def stop(self):
+    """Ends the run after its current step."""
+    with nogil:
+      pyasc_model_stop(self.model)
+
+  def run(self, t_eval, double dt, checkpoint = None, bint keep_snapshots = True):
+    """start() then wait(). Returns the snapshots."""
+    self.start(t_eval, dt, checkpoint, keep_snapshots)
+    self.wait()
+    return self.snapshots
+
+  @property
+  def progress(self):
+    """(t, steps taken, snapshots taken, whether still running)."""
+    cdef double t
+    cdef int64_t steps
+    cdef int32_t taken, running
+    pyasc_model_progress(self.model, &t, &steps, &taken, &running)
+    return t, steps, taken, bool(running)
+
+  @property
+  def t_snapshots(self):
+    """Times of the snapshots taken so far."""
+    if self.t_eval is None:
+      return np.empty(0)
+    return self.t_eval[:self.progress[2]].copy()
+
+  @property
+  def snapshots(self):
+    """Array of the snapshots of z taken so far, if they are kept."""
+    if self.snapshot_array is None:
+      return np.empty((0, self.rows, self.cols))
+    return self.snapshot_array[:self.progress[2]].copy()
+
+  @property
+  def z(self):
+    """Copy of the current elevations. The run must not be in progress."""
+    if self.progress[3]:
+      raise RuntimeError('the model is running')
+    cdef np.ndarray[double, ndim = 2, mode = 'c'] z = np.empty((self.rows, self.cols))
+    pyasc_model_elevations(self.model, &z[0,0])
+    return z
+
+# Runs kind 0 (area), 1 (area_dinf) or 2 (length) on every DEM in dems, a
+# list of 2D arrays or a 3D stack, with one DEM per thread and the GIL
+# released. dx is a scalar or one value per DEM.
+cdef list batch(dems, dx, int threads, int kind):
+
+  dems = [np.ascontiguousarray(dem, dtype = float) for dem in dems]
+  cdef int32_t count = len(dems)
+  cdef np.ndarray[double, ndim = 1, mode = 'c'] dxs = np.array(np.broadcast_to(np.asarray(dx, dtype = float), (count,)))
+  cdef int nout = 1 if kind == 2 else 2
+  results = [outputs(None, dem.shape, nout) for dem in dems]
+  if count == 0:
+    return []
+
+  cdef double **pdems = <double **> malloc(count*sizeof(double *))
+  cdef double **pa = <double **> malloc(count*sizeof(double *))
+  cdef double **ps = <double **> malloc(count*sizeof(double *))
+  cdef int32_t *m = <int32_t *> malloc(count*sizeof(int32_t))
+  cdef int32_t *n = <int32_t *> malloc(count*sizeof(int32_t))
+  cdef np.ndarray[double, ndim = 2, mode = 'c'] arr
+  try:
+    for i in range(count):
+      arr = dems[i]
+      pdems[i] = &arr[0,0]
+      m[i], n[i] = arr.shape[0], arr.shape[1]
+      arr = results[i][0]
+      pa[i] = &arr[0,0]
+      arr = results[i][nout-1]
+      ps[i] = &arr[0,0]
+    with nogil:
+      if kind == 2:
+        pylc_batch(pdems, &dxs[0], pa, m, n, count, threads)
+      else:
+        pyasc_batch(pdems, &dxs[0], pa, ps, m, n, count, threads, kind)
+  finally:
+    free(pdems)
+    free(pa)
+    free(ps)
+    free(m)
+    free(n)
+
+  if kind == 2:
+    return [l for (l,) in results]
+  return results
+
+def area_batch(dems, dx, int threads = 0):
+  """D8 area and slope of many DEMs at once. Returns a list of (a, s)."""
+  return batch(dems, dx, threads, 0)
+
+def area_dinf_batch(dems, dx, int threads = 0):
+  """D-infinity area and slope of many DEMs at once. Returns a list of (a, s)."""
+  return batch(dems, dx, threads, 1)
+
+def length_batch(dems, dx, int threads = 0):
+  """Flow length of many DEMs at once. Returns a list of arrays."""
+  return batch(dems, dx, threads, 2)
@@ -1,76 +1,444 @@
 #include "pyasc.h"
-#include "area_slope.hpp"
-#include "priority_flood.hpp"
+#include "flow_workspace.hpp"
+#include "model_dzdt.hpp"
+#include "stream_power.hpp"
+#include "landscape_model.hpp"
+#include "jacobian.hpp"
+#include "steady_state.hpp"
+#include "misfit.hpp"
+#include "flow_outputs.hpp"
+#include "parallel.hpp"
 
 using namespace richdem;
 using namespace std;
 
-void pyasc_dinf(double *dem, double dx, double *a, double *s, int32_t m, int32_t n) {
+void *pyasc_flood_new() {
+  return new IncrementalPriorityFlood<double>();
+}
 
-  Array2D<double> elevations(n, m, 0.0);
-  Array2D<double> areas(n, m, pow(dx,2));
-  Array2D<double> slopes(n, m, 0.0);
+void pyasc_flood_free(void *flood) {
+  delete static_cast<IncrementalPriorityFlood<double>*>(flood);
+}
 
-  for(int i=0; i<m; i++) {
-    for(int j=0; j<n; j++) {
-      elevations(j,i) = dem[i*n+j];
-    }
-  }
+void *pyasc_workspace_new() {
+  return new FlowWorkspace<double>();
+}
 
-  priority_flood_epsilon(elevations);
-  area_slope_dinf(elevations, dx, areas, slopes);
+void pyasc_workspace_free(void *workspace) {
+  delete static_cast<FlowWorkspace<double>*>(workspace);
+}
 
-  for(int i=0; i<m; i++) {
-    for(int j=0; j<n; j++) {
-      a[i*n+j] = areas(j,i);
-      s[i*n+j] = slopes(j,i);
-    }
-  }
+// Grids with more cells than a 32-bit i-address can hold are routed with
+// 64-bit ones, on a workspace of their own: the workspaces and flood states
+// handed out above are for 32-bit grids, so they are not used.
+static bool needs_64bit(int32_t m, int32_t n) {
+  return (uint64_t)m*n >= numeric_limits<uint32_t>::max();
+}
 
+// The caller's workspace, or `local` if it passed none
+template <class i_t>
+static FlowWorkspace<double,i_t> &workspace_or(void *workspace, FlowWorkspace<double,i_t> &local) {
+  return (workspace != NULL) ? *static_cast<FlowWorkspace<double,i_t>*>(workspace) : local;
 }
 
-void pyasc(double *dem, double dx, double *a, double *s, int32_t m, int32_t n) {
+// The caller's flood state, if any
+template <class i_t>
+static typename FlowWorkspace<double,i_t>::Flood *flood_state(void *flood) {
+  return static_cast<typename FlowWorkspace<double,i_t>::Flood*>(flood);
+}
 
-  Array2D<double> elevations(n, m, 0.0);
-  Array2D<double> areas(n, m, pow(dx,2));
-  Array2D<double> slopes(n, m, 0.0);
+template <class i_t>
+static void dinf(double *dem, double dx, double *a, double *s, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace) {
 
-  for(int i=0; i<m; i++) {
-    for(int j=0; j<n; j++) {
-      elevations(j,i) = dem[i*n+j];
-    }
-  }
+  FlowWorkspace<double,i_t> local;
+  FlowWorkspace<double,i_t> &ws = workspace_or(workspace, local);
 
-  priority_flood_epsilon(elevations);
-  area_slope(elevations, dx, areas, slopes);
+  // The workspace fills a copy, leaving the caller's DEM untouched
+  const Array2D<double,i_t> dem_view(dem, n, m);
+  Array2D<double,i_t> areas(a, n, m);
+  Array2D<double,i_t> slopes(s, n, m);
 
-  for(int i=0; i<m; i++) {
-    for(int j=0; j<n; j++) {
-      a[i*n+j] = areas(j,i);
-      s[i*n+j] = slopes(j,i);
-    }
-  }
+  areas.setAll(pow(dx,2));
+  slopes.setAll(0.0);
+
+  const vector<i_t> *flood_order = ws.fill(dem_view, threads, flood_state<i_t>(flood));
+  area_slope_dinf(ws.filled, dx, areas, slopes, flood_order, &ws.flow);
 
 }
 
-void pylc(double *dem, double dx, double *l, int32_t m, int32_t n) {
+void pyasc_dinf(double *dem, double dx, double *a, double *s, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace) {
+  if(needs_64bit(m, n))
+    dinf<uint64_t>(dem, dx, a, s, m, n, threads, NULL, NULL);
+  else
+    dinf<uint32_t>(dem, dx, a, s, m, n, threads, flood, workspace);
+}
 
-  Array2D<double> elevations(n, m, 0.0);
-  Array2D<double> len(n, m, 0.0);
+template <class i_t>
+static void dinf_filled(double *dem, double dx, double *a, double *s, double *filled, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace) {
 
-  for(int i=0; i<m; i++) {
-    for(int j=0; j<n; j++) {
-      elevations(j,i) = dem[i*n+j];
-    }
+  FlowWorkspace<double,i_t> local;
+  FlowWorkspace<double,i_t> &ws = workspace_or(workspace, local);
+
+  // The DEM is filled straight into the caller's buffer
+  const Array2D<double,i_t> dem_view(dem, n, m);
+  Array2D<double,i_t> filled_view(filled, n, m);
+  Array2D<double,i_t> areas(a, n, m);
+  Array2D<double,i_t> slopes(s, n, m);
+
+  areas.setAll(pow(dx,2));
+  slopes.setAll(0.0);
+
+  const vector<i_t> *flood_order = ws.fill(dem_view, filled_view, threads, flood_state<i_t>(flood));
+  area_slope_dinf(filled_view, dx, areas, slopes, flood_order, &ws.flow);
+
+}
+
+void pyasc_dinf_filled(double *dem, double dx, double *a, double *s, double *filled, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace) {
+  if(needs_64bit(m, n))
+    dinf_filled<uint64_t>(dem, dx, a, s, filled, m, n, threads, NULL, NULL);
+  else
+    dinf_filled<uint32_t>(dem, dx, a, s, filled, m, n, threads, flood, workspace);
+}
+
+template <class i_t>
+static void mfd(double *dem, double dx, double *a, double *s, double p, int32_t weighting, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace) {
+
+  FlowWorkspace<double,i_t> local;
+  FlowWorkspace<double,i_t> &ws = workspace_or(workspace, local);
+
+  // The workspace fills a copy, leaving the caller's DEM untouched
+  const Array2D<double,i_t> dem_view(dem, n, m);
+  Array2D<double,i_t> areas(a, n, m);
+  Array2D<double,i_t> slopes(s, n, m);
+
+  areas.setAll(pow(dx,2));
+  slopes.setAll(0.0);
+
+  const vector<i_t> *flood_order = ws.fill(dem_view, threads, flood_state<i_t>(flood));
+  area_slope_mfd(ws.filled, dx, areas, slopes, p, static_cast<MfdWeighting>(weighting), flood_order, &ws.flow);
+
+}
+
+void pyasc_mfd(double *dem, double dx, double *a, double *s, double p, int32_t weighting, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace) {
+  if(needs_64bit(m, n))
+    mfd<uint64_t>(dem, dx, a, s, p, weighting, m, n, threads, NULL, NULL);
+  else
+    mfd<uint32_t>(dem, dx, a, s, p, weighting, m, n, threads, flood, workspace);
+}
+
+template <class i_t>
+static void d8(double *dem, double dx, double *a, double *s, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace) {
+
+  FlowWorkspace<double,i_t> local;
+  FlowWorkspace<double,i_t> &ws = workspace_or(workspace, local);
+
+  // The workspace fills a copy, leaving the caller's DEM untouched
+  const Array2D<double,i_t> dem_view(dem, n, m);
+  Array2D<double,i_t> areas(a, n, m);
+  Array2D<double,i_t> slopes(s, n, m);
+
+  areas.setAll(pow(dx,2));
+  slopes.setAll(0.0);
+
+  const vector<i_t> *flood_order = ws.fill(dem_view, threads, flood_state<i_t>(flood));
+  area_slope(ws.filled, dx, areas, slopes, threads, flood_order, &ws.flow);
+
+}
+
+void pyasc(double *dem, double dx, double *a, double *s, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace) {
+  if(needs_64bit(m, n))
+    d8<uint64_t>(dem, dx, a, s, m, n, threads, NULL, NULL);
+  else
+    d8<uint32_t>(dem, dx, a, s, m, n, threads, flood, workspace);
+}
+
+template <class i_t>
+static void length(double *dem, double dx, double *l, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace) {
+
+  FlowWorkspace<double,i_t> local;
+  FlowWorkspace<double,i_t> &ws = workspace_or(workspace, local);
+
+  // The workspace fills a copy, leaving the caller's DEM untouched
+  const Array2D<double,i_t> dem_view(dem, n, m);
+  Array2D<double,i_t> len(l, n, m);
+
+  len.setAll(0.0);
+
+  const vector<i_t> *flood_order = ws.fill(dem_view, threads, flood_state<i_t>(flood));
+  length_(ws.filled, dx, len, flood_order, &ws.flow);
+
+}
+
+void pylc(double *dem, double dx, double *l, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace) {
+  if(needs_64bit(m, n))
+    length<uint64_t>(dem, dx, l, m, n, threads, NULL, NULL);
+  else
+    length<uint32_t>(dem, dx, l, m, n, threads, flood, workspace);
+}
+
+template <class i_t>
+static void outputs(double *dem, double dx, uint32_t mask, double *a, double *s, double *l, int64_t *receivers, double *filled, uint8_t *d8, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace) {
+
+  FlowWorkspace<double,i_t> local;
+  FlowWorkspace<double,i_t> &ws = workspace_or(workspace, local);
+
+  const Array2D<double,i_t> dem_view(dem, n, m);
+
+  FlowOutputBuffers<double> out;
+  out.area      = a;
+  out.slope     = s;
+  out.length    = l;
+  out.receivers = receivers;
+  out.filled    = filled;
+  out.d8        = d8;
+
+  d8_outputs(dem_view, dx, mask, out, threads, flood_state<i_t>(flood), ws);
+
+}
+
+void pyasc_outputs(double *dem, double dx, uint32_t mask, double *a, double *s, double *l, int64_t *receivers, double *filled, uint8_t *d8, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace) {
+  if(needs_64bit(m, n))
+    outputs<uint64_t>(dem, dx, mask, a, s, l, receivers, filled, d8, m, n, threads, NULL, NULL);
+  else
+    outputs<uint32_t>(dem, dx, mask, a, s, l, receivers, filled, d8, m, n, threads, flood, workspace);
+}
+
+template <class i_t>
+static void dzdt(double *z, double dx, double K, double U, double D, double exponent, double *rate_, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace) {
+
+  FlowWorkspace<double,i_t> local;
+  FlowWorkspace<double,i_t> &ws = workspace_or(workspace, local);
+
+  const Array2D<double,i_t> z_view(z, n, m);
+  Array2D<double,i_t> rate(rate_, n, m);
+
+  model_dzdt(z_view, dx, K, U, D, exponent, rate, threads, flood_state<i_t>(flood), ws);
+
+}
+
+void pydzdt(double *z, double dx, double K, double U, double D, double exponent, double *dzdt_, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace) {
+  if(needs_64bit(m, n))
+    dzdt<uint64_t>(z, dx, K, U, D, exponent, dzdt_, m, n, threads, NULL, NULL);
+  else
+    dzdt<uint32_t>(z, dx, K, U, D, exponent, dzdt_, m, n, threads, flood, workspace);
+}
+
+void pyasc_sparsity(int32_t m, int32_t n, int32_t *indptr, int32_t *indices) {
+  dzdt_sparsity(n, m, indptr, indices);
+}
+
+template <class i_t>
+static void jacobian(double *z, double dx, double K, double D, double exponent, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace, int32_t *indptr, int32_t *indices, double *data) {
+
+  FlowWorkspace<double,i_t> local;
+  FlowWorkspace<double,i_t> &ws = workspace_or(workspace, local);
+
+  const Array2D<double,i_t> z_view(z, n, m);
+
+  dzdt_jacobian(z_view, dx, K, D, exponent, threads, flood_state<i_t>(flood), ws, indptr, indices, data);
+
+}
+
+void pyasc_jacobian(double *z, double dx, double K, double D, double exponent, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace, int32_t *indptr, int32_t *indices, double *data) {
+  if(needs_64bit(m, n))
+    jacobian<uint64_t>(z, dx, K, D, exponent, m, n, threads, NULL, NULL, indptr, indices, data);
+  else
+    jacobian<uint32_t>(z, dx, K, D, exponent, m, n, threads, flood, workspace, indptr, indices, data);
+}
+
+template <class i_t>
+static int32_t steady(double *z, double dx, double K, double U, double D, double exponent, int32_t m, int32_t n, const SteadyStateOptions &opts, void *workspace, double *residuals, int32_t *krylov, int32_t *pseudo, int32_t *converged) {
+
+  FlowWorkspace<double,i_t> local;
+  FlowWorkspace<double,i_t> &ws = workspace_or(workspace, local);
+
+  Array2D<double,i_t> elevations(z, n, m);
+  const SteadyStateReport report = steady_state(elevations, dx, K, U, D, exponent, opts, ws);
+
+  // residuals has room for max_newton+max_ptc+1 values, the others for one fewer
+  std::copy(report.residuals.begin(), report.residuals.end(), residuals);
+  std::copy(report.krylov.begin(), report.krylov.end(), krylov);
+  std::copy(report.pseudo.begin(), report.pseudo.end(), pseudo);
+  *converged = report.converged;
+  return report.residuals.size();
+
+}
+
+int32_t pyasc_steady_state(double *z, double dx, double K, double U, double D, double exponent, int32_t m, int32_t n, double tol, int32_t max_newton, int32_t max_ptc, int32_t restart, int32_t max_krylov, double forcing, double dtau0, int32_t matrix_free, int32_t threads, void *workspace, double *residuals, int32_t *krylov, int32_t *pseudo, int32_t *converged) {
+
+  SteadyStateOptions opts;
+  opts.tol        = tol;
+  opts.max_newton = max_newton;
+  opts.max_ptc    = max_ptc;
+  opts.restart    = restart;
+  opts.max_krylov = max_krylov;
+  opts.forcing    = forcing;
+  opts.dtau0      = dtau0;
+  opts.matrix_free = matrix_free;
+  opts.threads    = threads;
+
+  if(needs_64bit(m, n))
+    return steady<uint64_t>(z, dx, K, U, D, exponent, m, n, opts, NULL, residuals, krylov, pseudo, converged);
+  return steady<uint32_t>(z, dx, K, U, D, exponent, m, n, opts, workspace, residuals, krylov, pseudo, converged);
+
+}
+
+template <class i_t>
+static double misfit(double *z, double dx, double ks, double theta, double weight, int32_t m, int32_t n, double *gradient, void *workspace) {
+
+  FlowWorkspace<double,i_t> local;
+  FlowWorkspace<double,i_t> &ws = workspace_or(workspace, local);
+
+  const Array2D<double,i_t> z_view(z, n, m);
+
+  return ks_misfit(z_view, dx, ks, theta, weight, gradient, ws);
+
+}
+
+double pyasc_ks_misfit(double *z, double dx, double ks, double theta, double weight, int32_t m, int32_t n, double *gradient, void *workspace) {
+  if(needs_64bit(m, n))
+    return misfit<uint64_t>(z, dx, ks, theta, weight, m, n, gradient, NULL);
+  return misfit<uint32_t>(z, dx, ks, theta, weight, m, n, gradient, workspace);
+}
+
+template <class i_t>
+static double misfit_values(double *values, double dx, double ks, double theta, double weight, int32_t m, int32_t n, double *gradient, double *terms, void *workspace) {
+
+  FlowWorkspace<double,i_t> local;
+  FlowWorkspace<double,i_t> &ws = workspace_or(workspace, local);
+
+  KsMisfitTerms<double> t;
+  const double misfit = ks_misfit_values(values, m, n, dx, ks, theta, weight, gradient, ws, &t);
+  if(terms != NULL) {
+    terms[0] = t.rms;
+    terms[1] = t.mean_ks;
+    terms[2] = t.penalty;
   }
+  return misfit;
+
+}
+
+double pyasc_ks_misfit_values(double *values, double dx, double ks, double theta, double weight, int32_t m, int32_t n, double *gradient, double *terms, void *workspace) {
+  // The grid routed is the interior padded with a row above and below
+  if(needs_64bit(m+2, n))
+    return misfit_values<uint64_t>(values, dx, ks, theta, weight, m, n, gradient, terms, NULL);
+  return misfit_values<uint32_t>(values, dx, ks, theta, weight, m, n, gradient, terms, workspace);
+}
+
+template <class i_t>
+static void sp_step(double *z, double dx, double K, double U, double exponent, double dt, int32_t m, int32_t n, void *workspace) {
+
+  FlowWorkspace<double,i_t> local;
+  FlowWorkspace<double,i_t> &ws = workspace_or(workspace, local);
+
+  Array2D<double,i_t> elevations(z, n, m);
+
+  stream_power_step(elevations, dx, K, U, exponent, dt, ws);
+
+}
+
+void pysp_step(double *z, double dx, double K, double U, double exponent, double dt, int32_t m, int32_t n, void *workspace) {
+  if(needs_64bit(m, n))
+    sp_step<uint64_t>(z, dx, K, U, exponent, dt, m, n, NULL);
+  else
+    sp_step<uint32_t>(z, dx, K, U, exponent, dt, m, n, workspace);
+}
+
+template <class i_t>
+static void diff_step(double *z, double dx, double D, double dt, int32_t m, int32_t n, int32_t threads, void *workspace) {
+
+  FlowWorkspace<double,i_t> local;
+  FlowWorkspace<double,i_t> &ws = workspace_or(workspace, local);
+
+  Array2D<double,i_t> elevations(z, n, m);
+
+  diffusion_step(elevations, dx, D, dt, threads, &ws.diffusion);
+
+}
+
+void pydiff_step(double *z, double dx, double D, double dt, int32_t m, int32_t n, int32_t threads, void *workspace) {
+  if(needs_64bit(m, n))
+    diff_step<uint64_t>(z, dx, D, dt, m, n, threads, NULL);
+  else
+    diff_step<uint32_t>(z, dx, D, dt, m, n, threads, workspace);
+}
+
+// Models are 32-bit: the handle is passed back to the functions below, which
+// take it as such. Larger grids get NULL, and are rejected by pyas.pyx
+// before this is reached.
+void *pyasc_model_new(double *z, int32_t m, int32_t n, double dx, double K, double U, double D, double exponent, int32_t threads, int32_t splitting, double t0) {
 
-  priority_flood_epsilon(elevations);
-  length_(elevations, dx, len);
+  if(needs_64bit(m, n))
+    return NULL;
+
+  const Array2D<double> z0(z, n, m);
+  LandscapeEvolutionModel<double> *model = new LandscapeEvolutionModel<double>(z0, dx, K, U, D, exponent, threads);
+  model->splitting = static_cast<Splitting>(splitting);
+  model->setTime(t0);
+  return model;
+
+}
+
+void pyasc_model_free(void *model) {
+  delete static_cast<LandscapeEvolutionModel<double>*>(model);
+}
+
+void pyasc_model_start(void *model, double *t_eval, int32_t count, double dt, double *snapshots, const char *checkpoint) {
+  LandscapeEvolutionModel<double> *lem = static_cast<LandscapeEvolutionModel<double>*>(model);
+  lem->stop();
+  if(checkpoint != NULL)
+    lem->checkpoint = checkpoint;
+  lem->start(vector<double>(t_eval, t_eval+count), dt, snapshots);
+}
+
+void pyasc_model_resume(void *model, const char *checkpoint) {
+  static_cast<LandscapeEvolutionModel<double>*>(model)->resume(checkpoint);
+}
 
-  for(int i=0; i<m; i++) {
-    for(int j=0; j<n; j++) {
-      l[i*n+j] = len(j,i);
+void pyasc_model_wait(void *model) {
+  static_cast<LandscapeEvolutionModel<double>*>(model)->wait();
+}
+
+void pyasc_model_stop(void *model) {
+  static_cast<LandscapeEvolutionModel<double>*>(model)->stop();
+}
+
+void pyasc_model_progress(void *model, double *t, int64_t *steps, int32_t *snapshots, int32_t *running) {
+
+  const LandscapeEvolutionModel<double> *lem = static_cast<LandscapeEvolutionModel<double>*>(model);
+  *t         = lem->t();
+  *steps     = lem->stepsTaken();
+  *snapshots = lem->snapshotsTaken();
+  *running   = lem->isRunning();
+
+}
+
+void pyasc_model_elevations(void *model, double *z) {
+
+  const LandscapeEvolutionModel<double> *lem = static_cast<LandscapeEvolutionModel<double>*>(model);
+  std::copy(lem->z.begin(), lem->z.end(), z);
+
+}
+
+void pyasc_batch(double **dems, double *dx, double **a, double **s, int32_t *m, int32_t *n, int32_t count, int32_t threads, int32_t dinf) {
+
+  // One DEM per task; each is processed on a single thread
+  parallel_for(count, 1, threads, [&](size_t begin, size_t end) {
+    for(size_t i=begin; i<end; i++) {
+      if(dinf)
+        pyasc_dinf(dems[i], dx[i], a[i], s[i], m[i], n[i], 1, NULL, NULL);
+      else
+        pyasc(dems[i], dx[i], a[i], s[i], m[i], n[i], 1, NULL, NULL);
     }
-  }
+  });
+
+}
+
+void pylc_batch(double **dems, double *dx, double **l, int32_t *m, int32_t *n, int32_t count, int32_t threads) {
+
+  parallel_for(count, 1, threads, [&](size_t begin, size_t end) {
+    for(size_t i=begin; i<end; i++)
+      pylc(dems[i], dx[i], l[i], m[i], n[i], 1, NULL, NULL);
+  });
 
 }
@@ -3,8 +3,33 @@
 #ifndef PYAS_H
 #define PYAS_H
 
-void pyasc(double *dem, double dx, double *a, double *s, int32_t m, int32_t n);
-void pyasc_dinf(double *dem, double dx, double *a, double *s, int32_t m, int32_t n);
-void pylc(double *dem, double dx, double *l, int32_t m, int32_t n);
+void pyasc(double *dem, double dx, double *a, double *s, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace);
+void pyasc_dinf(double *dem, double dx, double *a, double *s, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace);
+void pyasc_dinf_filled(double *dem, double dx, double *a, double *s, double *filled, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace);
+void pyasc_mfd(double *dem, double dx, double *a, double *s, double p, int32_t weighting, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace);
+void pylc(double *dem, double dx, double *l, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace);
+void pyasc_outputs(double *dem, double dx, uint32_t mask, double *a, double *s, double *l, int64_t *receivers, double *filled, uint8_t *d8, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace);
+void pydzdt(double *z, double dx, double K, double U, double D, double exponent, double *dzdt, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace);
+void pysp_step(double *z, double dx, double K, double U, double exponent, double dt, int32_t m, int32_t n, void *workspace);
+void pydiff_step(double *z, double dx, double D, double dt, int32_t m, int32_t n, int32_t threads, void *workspace);
+void pyasc_sparsity(int32_t m, int32_t n, int32_t *indptr, int32_t *indices);
+void pyasc_jacobian(double *z, double dx, double K, double D, double exponent, int32_t m, int32_t n, int32_t threads, void *flood, void *workspace, int32_t *indptr, int32_t *indices, double *data);
+int32_t pyasc_steady_state(double *z, double dx, double K, double U, double D, double exponent, int32_t m, int32_t n, double tol, int32_t max_newton, int32_t max_ptc, int32_t restart, int32_t max_krylov, double forcing, double dtau0, int32_t matrix_free, int32_t threads, void *workspace, double *residuals, int32_t *krylov, int32_t *pseudo, int32_t *converged);
+double pyasc_ks_misfit(double *z, double dx, double ks, double theta, double weight, int32_t m, int32_t n, double *gradient, void *workspace);
+double pyasc_ks_misfit_values(double *values, double dx, double ks, double theta, double weight, int32_t m, int32_t n, double *gradient, double *terms, void *workspace);
+void *pyasc_flood_new();
+void pyasc_flood_free(void *flood);
+void *pyasc_workspace_new();
+void pyasc_workspace_free(void *workspace);
+void *pyasc_model_new(double *z, int32_t m, int32_t n, double dx, double K, double U, double D, double exponent, int32_t threads, int32_t splitting, double t0);
+void pyasc_model_free(void *model);
+void pyasc_model_start(void *model, double *t_eval, int32_t count, double dt, double *snapshots, const char *checkpoint);
+void pyasc_model_resume(void *model, const char *checkpoint);
+void pyasc_model_wait(void *model);
+void pyasc_model_stop(void *model);
+void pyasc_model_progress(void *model, double *t, int64_t *steps, int32_t *snapshots, int32_t *running);
+void pyasc_model_elevations(void *model, double *z);
+void pyasc_batch(double **dems, double *dx, double **a, double **s, int32_t *m, int32_t *n, int32_t count, int32_t threads, int32_t dinf);
+void pylc_batch(double **dems, double *dx, double **l, int32_t *m, int32_t *n, int32_t count, int32_t threads);
 
 #endif // PYPF_H
@@ -1,7 +1,7 @@
 import numpy as np
 import matplotlib.pylab as plt
 from heapq import heappush, heappop
-from .pyas import area_dinf as area
+from .pyas import area_dinf as area, dzdt as native_dzdt, FloodState, FlowWorkspace, LandscapeEvolutionModel
 import pickle as p
 
 def calc_K_U_D(l, L, Rf, time_to_steady_state, Pe, ka, h, m):
@@ -15,12 +15,17 @@ def calc_K_U_D(l, L, Rf, time_to_steady_state, Pe, ka, h, m):
 
 import numpy as np
 
-def build_model_dzdt(size, dx, l, L, Rf, time_to_steady_state, Pe, ka, h, m, hook = None, renoise = None, return_dt = False):
+def build_model_dzdt(size, dx, l, L, Rf, time_to_steady_state, Pe, ka, h, m, hook = None, renoise = None, return_dt = False, native = False, warm_flood = False):
 
     K, U, D = calc_K_U_D(l, L, Rf, time_to_steady_state, Pe, ka, h, m)
 
     (ny, nx) = size
     build_model_dzdt.counter = 0
+    # Warm-starting the fill pays off once pits stop changing between calls,
+    # as near steady state, and costs a little while they keep changing
+    flood_state = FloodState() if warm_flood else None
+    workspace = FlowWorkspace()
+    area_out = (np.empty((ny, nx)), np.empty((ny, nx)))
 
     if hook is not None:
         hook.model_data = {"dx": dx,
@@ -43,11 +48,17 @@ def build_model_dzdt(size, dx, l, L, Rf, time_to_steady_state, Pe, ka, h, m, hoo
         z = np.reshape(y, (ny, nx))
         if renoise is not None:
             z += np.reshape(rand(nx*ny), (ny, nx))*renoise
+        if native:
+            dzdt = native_dzdt(z, dx, K, U, D, m, flood_state = flood_state, workspace = workspace)
+            build_model_dzdt.counter += 1
+            if hook is not None:
+                hook.register_new_step(t, y, dzdt, dx, U)
+            return np.reshape(dzdt, (ny*nx,))
         Qx = -D*np.diff(np.hstack((np.reshape(z[:,-1],(ny, 1)), z, np.reshape(z[:,0], (ny, 1)))), axis = 1)/dx
         Qy = -D*np.diff(z, axis = 0)/dx
         Qy = np.vstack((Qy[0,:]-np.ones((1,nx))*U*dx, Qy, np.ones((1,nx))*U*dx+Qy[-1,:]))
         dzdt_diffusion = -np.diff(Qx, axis = 1)/dx - np.diff(Qy, axis = 0)/dx
-        a, s = area(z, dx)
+        a, s = area(z, dx, flood_state = flood_state, workspace = workspace, out = area_out)
         build_model_dzdt.counter += 1
         dzdt_erosion = -K*np.power(a,m)*s
         dzdt = U + dzdt_diffusion + dzdt_erosion
@@ -59,6 +70,43 @@ def build_model_dzdt(size, dx, l, L, Rf, time_to_steady_state, Pe, ka, h, m, hoo
 
     return dzdt
 
+def build_model_jacobian(size, dx, l, L, Rf, time_to_steady_state, Pe, ka, h, m, warm_flood = False):
+
+    from scipy.sparse import csr_matrix
+    from .pyas import dzdt_jacobian, dzdt_sparsity
+
+    K, U, D = calc_K_U_D(l, L, Rf, time_to_steady_state, Pe, ka, h, m)
+
+    (ny, nx) = size
+    n = nx*ny
+    flood_state = FloodState() if warm_flood else None
+    workspace = FlowWorkspace()
+    indices, indptr = dzdt_sparsity(size)
+    sparsity = csr_matrix((np.ones(len(indices)), indices, indptr), shape = (n, n))
+
+    def jac(t, y):
+        z = np.reshape(y, (ny, nx))
+        return csr_matrix(dzdt_jacobian(z, dx, K, D, m, flood_state = flood_state, workspace = workspace), shape = (n, n))
+
+    return jac, sparsity
+
+def solve_steady_state(z0, dx, l, L, Rf, time_to_steady_state, Pe, ka, h, m, verbose = False, **kwargs):
+
+    from .pyas import steady_state
+    K, U, D = calc_K_U_D(l, L, Rf, time_to_steady_state, Pe, ka, h, m)
+    z = np.array(z0, dtype = float, order = 'C')
+    z, residuals, krylov, pseudo, converged = steady_state(z, dx, K, U, D, m, **kwargs)
+    if verbose:
+        print("Step 0: residual ", residuals[0], flush = True)
+        for i in range(len(krylov)):
+            print("Step", i+1, "(pseudo-transient):" if pseudo[i] else "(Newton):", "residual ", residuals[i+1], ", GMRES iterations ", krylov[i], flush = True)
+    return z, residuals, converged
+
+def build_native_model(z0, dx, l, L, Rf, time_to_steady_state, Pe, ka, h, m, threads = 1, splitting = 'strang'):
+
+    K, U, D = calc_K_U_D(l, L, Rf, time_to_steady_state, Pe, ka, h, m)
+    return LandscapeEvolutionModel(np.ascontiguousarray(z0, dtype = float), dx, K, U, D, m, threads = threads, splitting = splitting)
+
 def randomized_grid(shape, noise_level = 1.0, slope = 0.0):
     from numpy.random import rand
     from numpy.matlib import repmat
@@ -68,22 +116,31 @@ def randomized_grid(shape, noise_level = 1.0, slope = 0.0):
     z0[-1,:] = 0.0
     return z0
 
-def unfreeze_from_checkpoint_file(filename):
+def unfreeze_from_checkpoint_file(filename, native = False, warm_flood = False):
 
     (t, y, checkpointer) = p.load(open(filename + '_checkpoint.p', 'rb'))
     md = checkpointer.model_data
     (dx, K, U, D, m, ny, nx, tss) = (md['dx'], md['K'], md['U'], md['D'], md['m'], md['size'][0], md['size'][1], md['time_to_steady_state'])
 
     unfreeze_from_checkpoint_file.counter = 1
+    flood_state = FloodState() if warm_flood else None
+    workspace = FlowWorkspace()
+    area_out = (np.empty((ny, nx)), np.empty((ny, nx)))
 
     def dzdt(t, y):
 
         z = np.reshape(y, (ny, nx))
+        if native:
+            dzdt = native_dzdt(z, dx, K, U, D, m, flood_state = flood_state, workspace = workspace)
+            unfreeze_from_checkpoint_file.counter += 1
+            if checkpointer is not None:
+                checkpointer.register_new_step(t, y, dzdt, dx, U)
+            return np.reshape(dzdt, (ny*nx,))
         Qx = -D*np.diff(np.hstack((np.reshape(z[:,-1],(ny, 1)), z, np.reshape(z[:,0], (ny, 1)))), axis = 1)/dx
         Qy = -D*np.diff(z, axis = 0)/dx
         Qy = np.vstack((Qy[0,:]-np.ones((1,nx))*U*dx, Qy, np.ones((1,nx))*U*dx+Qy[-1,:]))
         dzdt_diffusion = -np.diff(Qx, axis = 1)/dx - np.diff(Qy, axis = 0)/dx
-        a, s = area(z, dx)
+        a, s = area(z, dx, flood_state = flood_state, workspace = workspace, out = area_out)
         unfreeze_from_checkpoint_file.counter += 1
         dzdt_erosion = -K*np.power(a,m)*s
         dzdt = U + dzdt_diffusion + dzdt_erosion
@@ -2,4 +2,4 @@
 
 cdef extern from "pypfc.h" nogil:
     ctypedef signed int int32_t;
-    void pypfc(double *dem, int32_t m, int32_t n)
+    void pypfc(double *dem, int32_t m, int32_t n, int32_t threads, int32_t radix, const double *no_data)
@@ -4,8 +4,16 @@ cimport pypf
 cimport numpy as np
 from libc.stdlib cimport malloc, free
 
-def flood(np.ndarray[double, ndim = 2, mode = 'c'] dem not None):
+def flood(np.ndarray[double, ndim = 2, mode = 'c'] dem not None, int threads = 1, bint radix = False, no_data = None):
+  """Fills dem in place. Cells equal to no_data, if given, are not part of
+  the DEM."""
 
-  m, n = dem.shape[0], dem.shape[1]
-
-  pypfc(&dem[0,0], m, n);
+  cdef int32_t m = dem.shape[0], n = dem.shape[1]
+  cdef double *pdem = &dem[0,0]
+  cdef double nd = 0
+  cdef const double *pnd = NULL
+  if no_data is not None:
+    nd = no_data
+    pnd = &nd
+  with nogil:
+    pypfc(pdem, m, n, threads, radix, pnd)
@@ -3,22 +3,34 @@
 
 using namespace std;
 
-void pypfc(double *dem, int32_t m, int32_t n) {
+// Grids with more cells than a 32-bit i-address can hold are filled with
+// 64-bit ones
+static bool needs_64bit(int32_t m, int32_t n) {
+  return (uint64_t)m*n >= numeric_limits<uint32_t>::max();
+}
 
-  Array2D<double> elevations(n, m, 0.0);
+template <class i_t>
+static void flood(double *dem, int32_t m, int32_t n, int32_t threads, int32_t radix, const double *no_data) {
 
-  for(int i=0; i<m; i++) {
-    for(int j=0; j<n; j++) {
-      elevations(j,i) = dem[i*n+j];
-    }
-  }
+  // Fills the caller's DEM in place
+  Array2D<double,i_t> elevations(dem, n, m);
+  if(no_data != NULL)
+    elevations.setNoData(*no_data);
 
-  priority_flood_epsilon(elevations);
+  if(radix && threads == 1)
+    priority_flood_epsilon<double, RadixHeap<double>, i_t>(elevations);
+  else if(radix)
+    priority_flood_epsilon_tiled<double, RadixHeap<double>, i_t>(elevations, threads);
+  else if(threads == 1)
+    priority_flood_epsilon<double, GridCellZ_pq<double>, i_t>(elevations);
+  else
+    priority_flood_epsilon_tiled<double, GridCellZ_pq<double>, i_t>(elevations, threads);
 
-  for(int i=0; i<m; i++) {
-    for(int j=0; j<n; j++) {
-      dem[i*n+j] = elevations(j,i);
-    }
-  }
+}
 
+void pypfc(double *dem, int32_t m, int32_t n, int32_t threads, int32_t radix, const double *no_data) {
+  if(needs_64bit(m, n))
+    flood<uint64_t>(dem, m, n, threads, radix, no_data);
+  else
+    flood<uint32_t>(dem, m, n, threads, radix, no_data);
 }
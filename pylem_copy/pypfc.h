@@ -3,6 +3,6 @@
 #ifndef PYPF_H
 #define PYPF_H
 
-void pypfc(double *dem, int32_t m, int32_t n);
+void pypfc(double *dem, int32_t m, int32_t n, int32_t threads, int32_t radix, const double *no_data);
 
 #endif // PYPF_H
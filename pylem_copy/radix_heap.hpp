@@ -0,0 +1,174 @@
+/**
+  @file
+  @brief Monotone radix heap usable in place of GridCellZ_pq as the open set
+         of the Priority-Flood algorithms.
+
+  A binary heap pays O(log N) scattered moves for every push and pop. A radix
+  heap instead files each cell into one of a handful of buckets by the highest
+  bit in which its key differs from the last key popped, and only re-files the
+  cells of one bucket when the lowest one runs dry. Every cell is re-filed at
+  most once per bit of the key, and all the work is appends to and scans of
+  contiguous vectors.
+
+  The catch is that the buckets only order keys no lower than the last key
+  popped. Priority-Flood mostly pushes such keys: a data cell's neighbours are
+  pushed only if they are higher than it. The exception is a NoData cell,
+  which is expanded from the pit queue below everything waiting and pushes
+  its data neighbours at their own, possibly lower, elevations. Such keys go
+  to a small binary heap which is emptied before the buckets are touched
+  again. The heap forgets the last key popped whenever it empties, so it may
+  be refilled with any keys.
+
+  Ahuja, R.K., Mehlhorn, K., Orlin, J., Tarjan, R.E., 1990. Faster algorithms
+  for the shortest path problem. Journal of the ACM 37, 213–223.
+*/
+#ifndef _radix_heap_hpp_
+#define _radix_heap_hpp_
+
+#include "richdem/common/grid_cell.hpp"
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+/**
+  @brief Maps an elevation to an unsigned integer with the same ordering.
+
+  Positive values have their sign bit set and negative values have all their
+  bits flipped.
+*/
+inline uint64_t radix_key(double z){
+  uint64_t u;
+  std::memcpy(&u, &z, sizeof(u));
+  return (u >> 63) ? ~u : (u | (uint64_t(1) << 63));
+}
+
+inline uint64_t radix_key(float z){
+  uint32_t u;
+  std::memcpy(&u, &z, sizeof(u));
+  return (u >> 31) ? ~u : (u | (uint32_t(1) << 31));
+}
+
+/**
+  @brief Min-priority queue of GridCellZ with the interface of GridCellZ_pq,
+         fastest when keys are pushed in monotone order.
+
+  Cells with equal keys are popped in an unspecified order, as with
+  GridCellZ_pq. top() is const, as for std::priority_queue, but may scan the
+  lowest non-empty bucket the first time it is called after a pop.
+*/
+template <class elev_t>
+class RadixHeap {
+ private:
+  typedef richdem::GridCellZ<elev_t> cell_t;
+
+  struct Entry {
+    uint64_t key;
+    cell_t   cell;
+  };
+
+  //Bucket 0 holds keys equal to last; bucket b>0 holds keys whose highest
+  //bit differing from last is bit b-1
+  std::vector<Entry> buckets[65];
+  uint64_t last;    ///< Key of the last cell popped from the buckets
+  size_t   count;
+
+  //Cells pushed below last. They are all lower than every bucketed cell, so
+  //they are popped first, and last does not move until they are gone.
+  richdem::GridCellZ_pq<elev_t> below;
+
+  //Location of the lowest entry, found by top() when bucket 0 is empty
+  mutable bool   found;
+  mutable int    min_bucket;
+  mutable size_t min_index;
+
+  static int bucket_of(uint64_t key, uint64_t last){
+    const uint64_t diff = key ^ last;
+#if defined(__GNUC__)
+    return diff ? 64-__builtin_clzll(diff) : 0;
+#else
+    int b = 0;
+    for(uint64_t d=diff;d;d>>=1)
+      b++;
+    return b;
+#endif
+  }
+
+  void find_min() const {
+    if(found)
+      return;
+    int b = 1;
+    while(buckets[b].empty())
+      b++;
+    size_t m = 0;
+    for(size_t i=1;i<buckets[b].size();i++)
+      if(buckets[b][i].key<buckets[b][m].key)
+        m = i;
+    min_bucket = b;
+    min_index  = m;
+    found      = true;
+  }
+
+ public:
+  RadixHeap() : last(0), count(0), found(false), min_bucket(0), min_index(0) {}
+
+  size_t size() const { return count; }
+  bool  empty() const { return count==0; }
+
+  void push(const cell_t &c){
+    const uint64_t key = radix_key(c.z);
+    count++;
+    if(key<last){
+      below.push(c);
+      return;
+    }
+    const int b = bucket_of(key, last);
+    buckets[b].push_back(Entry{key, c});
+    if(found && b>0 && key<buckets[min_bucket][min_index].key){
+      min_bucket = b;
+      min_index  = buckets[b].size()-1;
+    }
+  }
+
+  void emplace(int x, int y, elev_t z){
+    push(cell_t(x,y,z));
+  }
+
+  const cell_t& top() const {
+    if(!below.empty())
+      return below.top();
+    if(!buckets[0].empty())
+      return buckets[0].back().cell;
+    find_min();
+    return buckets[min_bucket][min_index].cell;
+  }
+
+  void pop(){
+    if(!below.empty()){
+      below.pop();
+      count--;
+      if(count==0)
+        last = 0;
+      return;
+    }
+    if(buckets[0].empty()){
+      //Advance last to the lowest key and re-file its bucket around it. Every
+      //entry moves to a lower bucket. The entry top() returned goes last, so
+      //that it is the one popped even if other keys equal it.
+      find_min();
+      std::vector<Entry> &from = buckets[min_bucket];
+      last = from[min_index].key;
+      for(size_t i=0;i<from.size();i++)
+        if(i!=min_index)
+          buckets[bucket_of(from[i].key, last)].push_back(from[i]);
+      buckets[0].push_back(from[min_index]);
+      from.clear();
+      found = false;
+    }
+    buckets[0].pop_back();
+    count--;
+    if(count==0)
+      last = 0;
+  }
+};
+
+#endif
@@ -9,7 +9,8 @@ ext_modules = [
         "pyas",
         sources=["pyas.pyx", "pyasc.cpp"],
         include_dirs=[np.get_include(), richdem_include_path],
-        extra_compile_args=["-std=c++11"] if any(f.endswith('.cpp') for f in ["pyas.pyx", "pyasc.cpp"]) else [],
+        extra_compile_args=["-std=c++11", "-pthread"] if any(f.endswith('.cpp') for f in ["pyas.pyx", "pyasc.cpp"]) else [],
+        extra_link_args=["-pthread"],
         language="c++"  # Specify the language for the extension
     )
 ]
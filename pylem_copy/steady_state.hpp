@@ -0,0 +1,381 @@
+/**
+  @file
+  @brief Steady-state solver for the landscape evolution model.
+
+  Solves dzdt(z) = 0, with dzdt as computed by model_dzdt(), by
+  Newton-Krylov. Each Newton step solves J d = -F with restarted GMRES.
+  Products with J are either finite differences of model_dzdt(), which see
+  the whole model, or products with the Jacobian of the frozen flow graph,
+  which leave out how the D-infinity partitions, and so the drainage area,
+  move with z. The differences are noisy wherever a small change of z
+  switches a cell's steepest facet, so the frozen graph is the default; it
+  makes the iteration a Newton iteration on each flow graph in turn. GMRES is
+  preconditioned on the right by the Jacobian of the frozen flow graph
+  (dzdt_jacobian()), keeping only the entries of cells which come before each
+  cell in the Priority-Flood order. The preconditioner is then triangular and
+  is applied by one sweep up the flood order, much like an implicit
+  stream-power step.
+
+  dzdt is not smooth where the fill or the steepest facet changes, and Newton
+  can stall there. When its line search fails, or it reduces the residual by
+  less than half in a step, the solver falls back to
+  pseudo-transient continuation: implicit Euler steps (I/dtau - J) d = F whose
+  pseudo-timestep grows as the residual falls (switched evolution
+  relaxation), so that the steps become Newton steps again near the solution.
+
+  Flow graph switches also put a floor under the residual that can be
+  reached, typically around 1e-3 of the uplift rate. Transient integration
+  reaches no lower.
+
+  Kelley, C.T., Keyes, D.E., 1998. Convergence analysis of pseudo-transient
+  continuation. SIAM Journal on Numerical Analysis 35, 508–523.
+*/
+#ifndef _steady_state_hpp_
+#define _steady_state_hpp_
+
+#include "model_dzdt.hpp"
+#include "jacobian.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+
+struct SteadyStateOptions {
+  double tol        = 1e-3;  ///< Converged when RMS(dzdt) <= tol*|U|
+  int max_newton    = 50;    ///< Newton steps before falling back
+  int max_ptc       = 500;   ///< Pseudo-transient steps after falling back
+  int restart       = 20;    ///< GMRES restart length; memory is restart+1 grids
+  int max_krylov    = 200;   ///< GMRES iterations per step
+  double forcing    = 1e-2;  ///< GMRES relative tolerance
+  double dtau0      = 0;     ///< First pseudo-timestep; 0 picks one from the residual
+  int threads       = 1;     ///< Threads used by model_dzdt()
+  bool matrix_free  = false; ///< Difference dzdt for J v, or else use the frozen-graph Jacobian
+};
+
+struct SteadyStateReport {
+  std::vector<double> residuals;  ///< RMS(dzdt)/|U| at the start and after every step
+  std::vector<int> krylov;        ///< GMRES iterations of every step
+  std::vector<int> pseudo;        ///< Whether every step was pseudo-transient
+  bool converged = false;
+};
+
+template <class elev_t, class i_t = uint32_t>
+class SteadyStateSolver {
+ private:
+  typedef std::vector<elev_t> vec_t;
+
+  const elev_t dx, K, U, D, m;
+  const SteadyStateOptions &opts;
+  FlowWorkspace<elev_t,i_t> &ws;
+  const xy_t nx, ny;
+  const i_t size;
+
+  Array2D<elev_t,i_t> trial;      ///< Elevations at which dzdt is evaluated
+  Array2D<elev_t,i_t> rate;       ///< dzdt at `trial`
+  std::vector<i_t> indptr, indices;
+  vec_t data;                     ///< Frozen-flow-graph Jacobian
+  std::vector<i_t> order;         ///< Flood order at the linearisation point
+  std::vector<i_t> position;      ///< Position of every cell in `order`
+  std::vector<vec_t> V;           ///< Krylov basis
+  vec_t w, u;
+
+  static elev_t dot(const vec_t &a, const vec_t &b) {
+    elev_t s = 0;
+    for(size_t i=0; i<a.size(); i++)
+      s += a[i]*b[i];
+    return s;
+  }
+
+  static elev_t norm(const vec_t &a) {
+    return std::sqrt(dot(a, a));
+  }
+
+  ///GMRES needs a basis of at least one vector, and makes no progress
+  ///without one
+  static int checked_restart(const SteadyStateOptions &opts) {
+    if(opts.restart < 1)
+      throw std::invalid_argument("SteadyStateSolver: restart must be at least 1");
+    if(opts.max_krylov < 0)
+      throw std::invalid_argument("SteadyStateSolver: max_krylov must not be negative");
+    return opts.restart;
+  }
+
+  bool interior(i_t i) const {
+    return i >= (i_t)nx && i < size-nx;
+  }
+
+ public:
+  SteadyStateSolver(elev_t dx, elev_t K, elev_t U, elev_t D, elev_t m, const SteadyStateOptions &opts, FlowWorkspace<elev_t,i_t> &ws, xy_t nx, xy_t ny)
+    : dx(dx), K(K), U(U), D(D), m(m), opts(opts), ws(ws), nx(nx), ny(ny), size((i_t)nx*ny),
+      trial(nx, ny), rate(nx, ny), indptr(size+1), indices(dzdt_nnz(nx, ny)), data(indices.size()),
+      position(size), V(checked_restart(opts)+1, vec_t(size)), w(size), u(size) {}
+
+  /**
+    @brief Evaluates dzdt at z into F.
+  */
+  void residual(const elev_t *z, vec_t &F) {
+    std::copy(z, z+size, trial.begin());
+    model_dzdt(trial, dx, K, U, D, m, rate, opts.threads, (typename FlowWorkspace<elev_t,i_t>::Flood*)NULL, ws);
+    std::copy(rate.begin(), rate.end(), F.begin());
+  }
+
+  elev_t rms(const vec_t &F) const {
+    return norm(F)/std::sqrt((elev_t)std::max<i_t>(size-2*nx, 1))/std::abs(U);
+  }
+
+  /**
+    @brief Freezes the flow graph at z for the preconditioner.
+  */
+  void linearise(const Array2D<elev_t,i_t> &z) {
+    dzdt_jacobian(z, dx, K, D, m, 1, (typename FlowWorkspace<elev_t,i_t>::Flood*)NULL, ws, indptr.data(), indices.data(), data.data());
+    order = ws.order;
+    for(i_t k=0; k<order.size(); k++)
+      position[order[k]] = k;
+  }
+
+  /**
+    @brief x = P^-1 b, with P = sigma I - J restricted to the entries of
+           cells earlier in the flood order.
+  */
+  void precondition(const vec_t &b, vec_t &x, elev_t sigma) const {
+    for(auto k = order.begin(); k != order.end(); ++k) {
+      const i_t i = *k;
+      if(!interior(i)) {
+        x[i] = 0;
+        continue;
+      }
+      elev_t sum = b[i];
+      elev_t diag = sigma;
+      for(i_t e=indptr[i]; e<indptr[i+1]; e++) {
+        const i_t j = indices[e];
+        if(j == i)
+          diag -= data[e];
+        else if(position[j] < position[i])
+          sum += data[e]*x[j];
+      }
+      x[i] = sum/diag;
+    }
+  }
+
+  /**
+    @brief out = (sigma I - J) v, with J v differenced about z, where dzdt
+           is F.
+  */
+  void apply(const elev_t *z, const vec_t &F, elev_t znorm, elev_t sigma, const vec_t &v, vec_t &out) {
+    if(!opts.matrix_free) {
+      for(i_t i=0; i<size; i++) {
+        elev_t Jv = 0;
+        for(i_t e=indptr[i]; e<indptr[i+1]; e++)
+          Jv += data[e]*v[indices[e]];
+        out[i] = sigma*v[i] - Jv;
+      }
+      return;
+    }
+    const elev_t vnorm = norm(v);
+    if(vnorm == 0) {
+      std::fill(out.begin(), out.end(), 0);
+      return;
+    }
+    const elev_t eps = std::sqrt(1e-16)*(1 + znorm)/vnorm;
+    for(i_t i=0; i<size; i++)
+      trial(i) = z[i] + eps*v[i];
+    model_dzdt(trial, dx, K, U, D, m, rate, opts.threads, (typename FlowWorkspace<elev_t,i_t>::Flood*)NULL, ws);
+    for(i_t i=0; i<size; i++)
+      out[i] = sigma*v[i] - (rate(i) - F[i])/eps;
+  }
+
+  /**
+    @brief Solves (sigma I - J) d = F by right-preconditioned restarted
+           GMRES.
+
+    @return Iterations taken
+  */
+  int gmres(const elev_t *z, const vec_t &F, elev_t sigma, vec_t &d) {
+    const int restart = opts.restart;
+    const elev_t znorm = std::sqrt(std::inner_product(z, z+size, z, (elev_t)0));
+    const elev_t target = opts.forcing*norm(F);
+
+    std::vector<std::vector<elev_t> > H(restart+1, std::vector<elev_t>(restart));
+    std::vector<elev_t> cs(restart), sn(restart), g(restart+1), y(restart);
+
+    std::fill(d.begin(), d.end(), 0);
+    int its = 0;
+    while(its < opts.max_krylov) {
+      //r = F - A d, in V[0]
+      if(its == 0) {
+        V[0] = F;
+      } else {
+        apply(z, F, znorm, sigma, d, w);
+        for(i_t i=0; i<size; i++)
+          V[0][i] = F[i] - w[i];
+      }
+      const elev_t beta = norm(V[0]);
+      if(beta <= target || beta == 0)
+        break;
+      for(auto &x: V[0])
+        x /= beta;
+      std::fill(g.begin(), g.end(), 0);
+      g[0] = beta;
+
+      int j = 0;
+      for(; j<restart && its<opts.max_krylov; j++, its++) {
+        precondition(V[j], u, sigma);
+        apply(z, F, znorm, sigma, u, w);
+        for(int k=0; k<=j; k++) {
+          H[k][j] = dot(w, V[k]);
+          for(i_t i=0; i<size; i++)
+            w[i] -= H[k][j]*V[k][i];
+        }
+        H[j+1][j] = norm(w);
+        if(H[j+1][j] != 0)
+          for(i_t i=0; i<size; i++)
+            V[j+1][i] = w[i]/H[j+1][j];
+
+        for(int k=0; k<j; k++) {
+          const elev_t t = cs[k]*H[k][j] + sn[k]*H[k+1][j];
+          H[k+1][j] = -sn[k]*H[k][j] + cs[k]*H[k+1][j];
+          H[k][j]   = t;
+        }
+        const elev_t r = std::hypot(H[j][j], H[j+1][j]);
+        cs[j] = H[j][j]/r;
+        sn[j] = H[j+1][j]/r;
+        H[j][j]   = r;
+        H[j+1][j] = 0;
+        g[j+1] = -sn[j]*g[j];
+        g[j]   =  cs[j]*g[j];
+
+        if(std::abs(g[j+1]) <= target) {
+          j++;
+          its++;
+          break;
+        }
+      }
+
+      //d += P^-1 V y, with H y = g
+      for(int k=j-1; k>=0; k--) {
+        y[k] = g[k];
+        for(int l=k+1; l<j; l++)
+          y[k] -= H[k][l]*y[l];
+        y[k] /= H[k][k];
+      }
+      std::fill(w.begin(), w.end(), 0);
+      for(int k=0; k<j; k++)
+        for(i_t i=0; i<size; i++)
+          w[i] += y[k]*V[k][i];
+      precondition(w, u, sigma);
+      for(i_t i=0; i<size; i++)
+        d[i] += u[i];
+
+      if(std::abs(g[j]) <= target)
+        break;
+    }
+    return its;
+  }
+};
+
+/**
+  @brief Finds the steady state of the model, starting from z.
+
+  @param[in,out] z          Initial guess; the steady state on exit, or the
+                            iterate with the smallest residual if the
+                            solver did not converge
+  @param[in]     dx, K, U, D, m  As for model_dzdt()
+  @param[in]     opts       Tolerances and limits
+  @param[in,out] ws         Buffers reused between calls
+
+  @return The residual norm and work of every step
+
+  @throws std::invalid_argument if opts.restart is below 1 or
+          opts.max_krylov is negative
+*/
+template <class elev_t, class i_t>
+SteadyStateReport steady_state(Array2D<elev_t,i_t> &z, elev_t dx, elev_t K, elev_t U, elev_t D, elev_t m, const SteadyStateOptions &opts, FlowWorkspace<elev_t,i_t> &ws) {
+
+  const i_t size = z.size();
+  SteadyStateSolver<elev_t,i_t> solver(dx, K, U, D, m, opts, ws, z.width(), z.height());
+  SteadyStateReport report;
+
+  std::vector<elev_t> F(size), Fnew(size), d(size), znew(size);
+  solver.residual(z.getData(), F);
+  elev_t res = solver.rms(F);
+  report.residuals.push_back(res);
+
+  std::vector<elev_t> best(z.begin(), z.end());
+  elev_t best_res = res;
+
+  bool pseudo = false;
+  elev_t dtau = opts.dtau0;
+  int newton_steps = 0, pseudo_steps = 0;
+
+  while(res > opts.tol) {
+    if(!pseudo && newton_steps >= opts.max_newton)
+      pseudo = true;
+    if(pseudo && pseudo_steps >= opts.max_ptc)
+      break;
+    if(pseudo && dtau <= 0) {
+      //Start with steps which move the surface by about 1% of its relief
+      const auto range = std::minmax_element(z.begin(), z.end());
+      const elev_t relief = *range.second - *range.first;
+      dtau = 0.01*relief/(res*std::abs(U));
+    }
+
+    const bool step_pseudo = pseudo;
+    solver.linearise(z);
+    const elev_t sigma = pseudo ? 1/dtau : 0;
+    const int its = solver.gmres(z.getData(), F, sigma, d);
+
+    if(!pseudo) {
+      //Backtracking line search on the residual norm
+      elev_t lambda = 1;
+      elev_t newres = res;
+      for(int halvings=0; halvings<8; halvings++, lambda/=2) {
+        for(i_t i=0; i<size; i++)
+          znew[i] = z(i) + lambda*d[i];
+        solver.residual(znew.data(), Fnew);
+        newres = solver.rms(Fnew);
+        if(newres < (1 - 1e-4*lambda)*res)
+          break;
+      }
+      newton_steps++;
+      if(!(newres < (1 - 1e-4*lambda)*res)) {
+        pseudo = true;
+        continue;
+      }
+      //Newton converging at less than a linear rate of 1/2 has stalled; the
+      //step is kept, but the following ones are pseudo-transient
+      if(newres > res/2)
+        pseudo = true;
+    } else {
+      for(i_t i=0; i<size; i++)
+        znew[i] = z(i) + d[i];
+      solver.residual(znew.data(), Fnew);
+      const elev_t newres = solver.rms(Fnew);
+      pseudo_steps++;
+      if(!(newres < 2*res)) {
+        dtau /= 4;
+        continue;
+      }
+      dtau *= std::min<elev_t>(10, res/newres);
+    }
+
+    std::copy(znew.begin(), znew.end(), z.begin());
+    F.swap(Fnew);
+    res = solver.rms(F);
+    report.residuals.push_back(res);
+    report.krylov.push_back(its);
+    report.pseudo.push_back(step_pseudo);
+    if(res < best_res) {
+      best_res = res;
+      best.assign(z.begin(), z.end());
+    }
+  }
+
+  report.converged = res <= opts.tol;
+  if(!report.converged)
+    std::copy(best.begin(), best.end(), z.begin());
+  return report;
+}
+
+#endif
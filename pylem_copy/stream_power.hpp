@@ -0,0 +1,75 @@
+/**
+  @file
+  @brief Implicit stream-power erosion step.
+
+  Integrates dz/dt = U - K A^m S over one timestep with the implicit scheme of
+  Braun & Willett (2013). Flow is routed over the filled DEM by D8, and cells
+  are then visited from base level upstream. Each cell's receiver has already
+  been updated when the cell is reached, so the backward Euler equation
+
+    z' = z + U dt - K A^m dt (z' - z'_r) / L
+
+  has the closed-form solution z' = (z + U dt + F z'_r)/(1 + F), with
+  F = K A^m dt / L. The step is stable for any dt.
+
+  Braun, J., Willett, S.D., 2013. A very efficient O(n), implicit and parallel
+  method to solve the stream power equation governing fluvial incision and
+  landscape evolution. Geomorphology 180–181, 170–179.
+*/
+#ifndef _stream_power_hpp_
+#define _stream_power_hpp_
+
+#include "flow_workspace.hpp"
+
+#include <cmath>
+
+/**
+  @brief Advances z by one implicit stream-power step.
+
+  The top and bottom rows are base level and stay fixed. Cells lying below
+  their receiver, such as the floors of depressions, are uplifted but not
+  eroded.
+
+  @param[in,out] z   Elevations
+  @param[in]     dx  Grid spacing
+  @param[in]     K, U, m  Erodibility, uplift rate and area exponent
+  @param[in]     dt  Timestep
+  @param[in,out] ws  Buffers reused between calls. On exit ws.area holds the
+                     drainage area the step used.
+*/
+template <class elev_t, class i_t>
+void stream_power_step(Array2D<elev_t,i_t> &z, elev_t dx, elev_t K, elev_t U, elev_t m, elev_t dt, FlowWorkspace<elev_t,i_t> &ws) {
+
+  const xy_t nx = z.width();
+  const xy_t ny = z.height();
+
+  for(xy_t y=1; y<ny-1; y++)
+  for(xy_t x=0; x<nx; x++)
+    z(x, y) += U*dt;
+
+  ws.area.resize(nx, ny);
+  ws.slope.resize(nx, ny);
+  ws.area.setAll(dx*dx);
+  ws.slope.setAll(0.0);
+
+  //The serial flood records an order in which receivers precede donors
+  const std::vector<i_t> &order = *ws.fill(z, 1, NULL);
+  area_slope(ws.filled, dx, ws.area, ws.slope, 1, &order, &ws.flow);
+  const std::vector<i_t> &receivers = ws.flow.receivers;
+
+  const elev_t diagonal = std::sqrt(2.0)*dx;
+  for(auto k = order.begin(); k != order.end(); ++k) {
+    const i_t c = *k;
+    const i_t r = receivers[c];
+    if(r == c || z(c) <= z(r))
+      continue;
+    xy_t cx, cy, rx, ry;
+    z.iToxy(c, cx, cy);
+    z.iToxy(r, rx, ry);
+    const elev_t L = (cx != rx && cy != ry) ? diagonal : dx;
+    const elev_t F = K*std::pow(ws.area(c), m)*dt/L;
+    z(c) = (z(c) + F*z(r))/(1 + F);
+  }
+}
+
+#endif